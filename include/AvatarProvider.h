@@ -18,8 +18,22 @@
 #pragma once
 
 #include <QImage>
+#include <QSize>
 #include <functional>
 
+//! Where an avatar is displayed, which determines the resolution it's downloaded at.
+enum class AvatarTier
+{
+        //! Mention suggestions.
+        Small,
+        //! Next to the messages.
+        Timeline,
+        //! Room list (also used by the top bar), communities, member list & read receipts.
+        List,
+        //! The user's own profile.
+        Profile,
+};
+
 class AvatarProvider : public QObject
 {
         Q_OBJECT
@@ -30,5 +44,11 @@ public:
         static void resolve(const QString &room_id,
                             const QString &userId,
                             QObject *receiver,
-                            std::function<void(QImage)> callback);
+                            std::function<void(QImage)> callback,
+                            AvatarTier tier = AvatarTier::Timeline);
+
+        //! Resolution of the avatars of a tier in device pixels.
+        static QSize resolution(AvatarTier tier);
+        //! Key of an avatar of a tier in the media cache.
+        static QString cacheKey(const QString &url, AvatarTier tier);
 };
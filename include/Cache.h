@@ -130,6 +130,86 @@ from_json(const json &j, MemberInfo &info)
         info.avatar_url = j.at("avatar_url");
 }
 
+//! Media that has already been uploaded to the media repository.
+struct UploadedMedia
+{
+        //! The content uri of the media. Empty if the media hasn't been uploaded.
+        std::string url;
+        std::string mimetype;
+        uint64_t size = 0;
+};
+
+inline void
+to_json(json &j, const UploadedMedia &media)
+{
+        j["url"]      = media.url;
+        j["mimetype"] = media.mimetype;
+        j["size"]     = media.size;
+}
+
+inline void
+from_json(const json &j, UploadedMedia &media)
+{
+        media.url      = j.at("url");
+        media.mimetype = j.at("mimetype");
+        media.size     = j.at("size");
+}
+
+//! A message of the user that hasn't been confirmed by the server yet.
+struct OutboxMessage
+{
+        std::string room_id;
+        int txn_id = 0;
+        mtx::events::MessageType type = mtx::events::MessageType::Text;
+        //! The text of the message, or the content uri of the media.
+        std::string body;
+        std::string filename;
+        std::string mime;
+        uint64_t media_size = 0;
+};
+
+inline void
+to_json(json &j, const OutboxMessage &msg)
+{
+        j["room_id"]    = msg.room_id;
+        j["txn_id"]     = msg.txn_id;
+        j["type"]       = static_cast<int>(msg.type);
+        j["body"]       = msg.body;
+        j["filename"]   = msg.filename;
+        j["mime"]       = msg.mime;
+        j["media_size"] = msg.media_size;
+}
+
+inline void
+from_json(const json &j, OutboxMessage &msg)
+{
+        msg.room_id    = j.at("room_id");
+        msg.txn_id     = j.at("txn_id");
+        msg.type       = static_cast<mtx::events::MessageType>(j.at("type").get<int>());
+        msg.body       = j.at("body");
+        msg.filename   = j.at("filename");
+        msg.mime       = j.at("mime");
+        msg.media_size = j.at("media_size");
+}
+
+//! Serialized state changes of a room, prepared outside of the write transaction.
+struct StateUpdates
+{
+        struct Member
+        {
+                std::string user_id;
+                //! Whether the user left (or was kicked/banned from) the room.
+                bool removed = false;
+                MemberInfo info;
+                std::string data;
+        };
+
+        //! Pairs of event type & serialized state event, in the order they were received.
+        std::vector<std::pair<std::string, std::string>> state;
+        //! Membership changes, in the order they were received.
+        std::vector<Member> members;
+};
+
 struct RoomSearchResult
 {
         std::string room_id;
@@ -153,6 +233,8 @@ public:
         static std::string displayName(const std::string &room_id, const std::string &user_id);
         static QString displayName(const QString &room_id, const QString &user_id);
         static QString avatarUrl(const QString &room_id, const QString &user_id);
+        //! Whether the member info of the user is available.
+        static bool isMemberKnown(const QString &room_id, const QString &user_id);
 
         static void removeDisplayName(const QString &room_id, const QString &user_id);
         static void removeAvatarUrl(const QString &room_id, const QString &user_id);
@@ -190,10 +272,23 @@ public:
                                            std::size_t len        = 30);
 
         void saveState(const mtx::responses::Sync &res);
+        //! Store the members of a room that were retrieved on demand.
+        void saveMembers(
+          const std::string &room_id,
+          const std::vector<mtx::events::StateEvent<mtx::events::state::Member>> &members);
         bool isInitialized() const;
 
         QString nextBatchToken() const;
 
+        //! The highest transaction id that may have been used.
+        int transactionId() const;
+        void saveTransactionId(int txn_id);
+
+        //! The messages that haven't been confirmed yet, in the order they were sent.
+        std::vector<OutboxMessage> outbox() const;
+        void saveOutboxMessage(const OutboxMessage &msg);
+        void removeOutboxMessage(int txn_id);
+
         void deleteData();
 
         void removeInvite(lmdb::txn &txn, const std::string &room_id);
@@ -239,6 +334,10 @@ public:
         }
         void saveImage(const QString &url, const QByteArray &data);
 
+        //! Retrieve the media that was uploaded with the given content hash.
+        UploadedMedia uploadedMedia(const QByteArray &hash) const;
+        void saveUploadedMedia(const QByteArray &hash, const UploadedMedia &media);
+
         RoomInfo singleRoomInfo(const std::string &room_id);
         std::vector<std::string> roomsWithStateUpdates(const mtx::responses::Sync &res);
         std::map<QString, RoomInfo> getRoomInfo(const std::vector<std::string> &rooms);
@@ -253,11 +352,14 @@ public:
         std::vector<RoomSearchResult> searchRooms(const std::string &query,
                                                   std::uint8_t max_items = 5);
 
-        void markSentNotification(const std::string &event_id);
-        //! Removes an event from the sent notifications.
-        void removeReadNotification(const std::string &event_id);
-        //! Check if we have sent a desktop notification for the given event id.
-        bool isNotificationSent(const std::string &event_id);
+        //! Mark the notifications as sent & return the ones that weren't sent before.
+        //!
+        //! The read notifications are removed from the sent ones and the timestamp
+        //! of the newest notification is saved, all in a single transaction.
+        std::vector<mtx::responses::Notification> markSentNotifications(
+          const std::vector<mtx::responses::Notification> &notifications);
+        //! Timestamp of the newest notification that has been retrieved.
+        uint64_t newestNotificationTs() const;
 
 private:
         //! Save an invited room.
@@ -273,70 +375,21 @@ private:
         //! Remove a room from the cache.
         // void removeLeftRoom(lmdb::txn &txn, const std::string &room_id);
         template<class T>
-        void saveStateEvents(lmdb::txn &txn,
-                             const lmdb::dbi &statesdb,
-                             const lmdb::dbi &membersdb,
-                             const std::string &room_id,
-                             const std::vector<T> &events)
+        void prepareStateEvents(StateUpdates &updates, const std::vector<T> &events)
         {
                 for (const auto &e : events)
-                        saveStateEvent(txn, statesdb, membersdb, room_id, e);
+                        prepareStateEvent(updates, e);
         }
 
+        //! Serialize a state event. It doesn't touch the database so it can run concurrently.
         template<class T>
-        void saveStateEvent(lmdb::txn &txn,
-                            const lmdb::dbi &statesdb,
-                            const lmdb::dbi &membersdb,
-                            const std::string &room_id,
-                            const T &event)
+        void prepareStateEvent(StateUpdates &updates, const T &event)
         {
                 using namespace mtx::events;
                 using namespace mtx::events::state;
 
                 if (mpark::holds_alternative<StateEvent<Member>>(event)) {
-                        const auto e = mpark::get<StateEvent<Member>>(event);
-
-                        switch (e.content.membership) {
-                        //
-                        // We only keep users with invite or join membership.
-                        //
-                        case Membership::Invite:
-                        case Membership::Join: {
-                                auto display_name = e.content.display_name.empty()
-                                                      ? e.state_key
-                                                      : e.content.display_name;
-
-                                // Lightweight representation of a member.
-                                MemberInfo tmp{display_name, e.content.avatar_url};
-
-                                lmdb::dbi_put(txn,
-                                              membersdb,
-                                              lmdb::val(e.state_key),
-                                              lmdb::val(json(tmp).dump()));
-
-                                insertDisplayName(QString::fromStdString(room_id),
-                                                  QString::fromStdString(e.state_key),
-                                                  QString::fromStdString(display_name));
-
-                                insertAvatarUrl(QString::fromStdString(room_id),
-                                                QString::fromStdString(e.state_key),
-                                                QString::fromStdString(e.content.avatar_url));
-
-                                break;
-                        }
-                        default: {
-                                lmdb::dbi_del(
-                                  txn, membersdb, lmdb::val(e.state_key), lmdb::val(""));
-
-                                removeDisplayName(QString::fromStdString(room_id),
-                                                  QString::fromStdString(e.state_key));
-                                removeAvatarUrl(QString::fromStdString(room_id),
-                                                QString::fromStdString(e.state_key));
-
-                                break;
-                        }
-                        }
-
+                        prepareMemberEvent(updates, mpark::get<StateEvent<Member>>(event));
                         return;
                 }
 
@@ -344,13 +397,52 @@ private:
                         return;
 
                 mpark::visit(
-                  [&txn, &statesdb](auto e) {
-                          lmdb::dbi_put(
-                            txn, statesdb, lmdb::val(to_string(e.type)), lmdb::val(json(e).dump()));
+                  [&updates](auto e) {
+                          updates.state.emplace_back(to_string(e.type), json(e).dump());
                   },
                   event);
         }
 
+        void prepareMemberEvent(
+          StateUpdates &updates,
+          const mtx::events::StateEvent<mtx::events::state::Member> &event)
+        {
+                using namespace mtx::events::state;
+
+                StateUpdates::Member update;
+                update.user_id = event.state_key;
+
+                switch (event.content.membership) {
+                //
+                // We only keep users with invite or join membership.
+                //
+                case Membership::Invite:
+                case Membership::Join: {
+                        auto display_name = event.content.display_name.empty()
+                                              ? event.state_key
+                                              : event.content.display_name;
+
+                        // Lightweight representation of a member.
+                        update.info = MemberInfo{display_name, event.content.avatar_url};
+                        update.data = json(update.info).dump();
+                        break;
+                }
+                default: {
+                        update.removed = true;
+                        break;
+                }
+                }
+
+                updates.members.emplace_back(std::move(update));
+        }
+
+        //! Write the prepared state changes of a room.
+        void applyStateUpdates(lmdb::txn &txn,
+                               const lmdb::dbi &statesdb,
+                               const lmdb::dbi &membersdb,
+                               const std::string &room_id,
+                               const StateUpdates &updates);
+
         template<class T>
         bool isStateEvent(const T &e)
         {
@@ -447,6 +539,8 @@ private:
         lmdb::dbi roomsDb_;
         lmdb::dbi invitesDb_;
         lmdb::dbi mediaDb_;
+        lmdb::dbi uploadsDb_;
+        lmdb::dbi outboxDb_;
         lmdb::dbi readReceiptsDb_;
         lmdb::dbi notificationsDb_;
 
@@ -20,13 +20,20 @@
 #include <QFrame>
 #include <QHBoxLayout>
 #include <QMap>
+#include <QMutex>
 #include <QPixmap>
+#include <QThreadPool>
 #include <QTimer>
 #include <QWidget>
 
+#include <atomic>
+#include <set>
+
 #include "Cache.h"
 #include "CommunitiesList.h"
 #include "Community.h"
+#include "RetryPolicy.h"
+#include "SyncSnapshot.h"
 
 #include <mtx.hpp>
 
@@ -50,7 +57,6 @@ constexpr int CONSENSUS_TIMEOUT      = 1000;
 constexpr int SHOW_CONTENT_TIMEOUT   = 3000;
 constexpr int TYPING_REFRESH_TIMEOUT = 10000;
 
-Q_DECLARE_METATYPE(mtx::responses::Rooms)
 Q_DECLARE_METATYPE(std::vector<std::string>)
 
 class ChatPage : public QWidget
@@ -71,6 +77,10 @@ public:
         QSharedPointer<UserSettings> userSettings() { return userSettings_; }
         void deleteConfigs();
 
+        //! Retrieve the members of a room that were omitted from the sync (lazy loading).
+        //! The members of each room are retrieved once per session.
+        void loadRoomMembers(const QString &room_id);
+
 signals:
         void contentLoaded();
         void closing();
@@ -83,25 +93,34 @@ signals:
         void startConsesusTimer();
 
         void initializeRoomList(QMap<QString, RoomInfo>);
-        void initializeViews(const mtx::responses::Rooms &rooms);
+        void initializeViews(const SyncSnapshot &res);
         void initializeEmptyViews(const std::vector<std::string> &rooms);
-        void syncUI(const mtx::responses::Rooms &rooms);
+        //! Retrieve the history of the rooms, in the given order.
+        void backfillRooms(const std::vector<std::string> &rooms);
+        //! Saved sync responses are waiting to be applied to the UI.
+        void syncUI();
         void continueSync(const QString &next_batch);
         void syncRoomlist(const std::map<QString, RoomInfo> &updates);
         void syncTopBar(const std::map<QString, RoomInfo> &updates);
+        //! A sync response has been saved & applied to the UI.
+        void syncBatchSaved();
+        //! A sync response couldn't be saved; the sync has to restart from the cache.
+        void syncSaveFailed();
+        //! The members of the room have been retrieved and stored.
+        void roomMembersLoaded(const QString &room_id);
 
 private slots:
         void showUnreadMessageNotification(int count);
         void updateTopBarAvatar(const QString &roomid, const QPixmap &img);
         void updateOwnProfileInfo(const QUrl &avatar_url, const QString &display_name);
         void updateOwnCommunitiesInfo(const QList<QString> &own_communities);
-        void initialSyncCompleted(const mtx::responses::Sync &response);
-        void syncCompleted(const mtx::responses::Sync &response);
+        void initialSyncCompleted(const SyncSnapshot &response);
+        void syncCompleted(const SyncSnapshot &response);
         void changeTopRoomInfo(const QString &room_id);
         void logout();
         void removeRoom(const QString &room_id);
         //! Handles initial sync failures.
-        void retryInitialSync(int status_code = -1);
+        void retryInitialSync(int status_code = -1, int server_delay = -1);
 
 private:
         static ChatPage *instance_;
@@ -121,6 +140,9 @@ private:
 
         void updateTypingUsers(const QString &roomid, const std::vector<std::string> &user_ids);
 
+        //! Apply all the sync responses that are waiting for the UI at once.
+        void applyPendingSyncs();
+
         void loadStateFromCache();
         void resetUI();
         //! Decides whether or not to hide the group's sidebar.
@@ -164,6 +186,27 @@ private:
         QTimer *syncTimeoutTimer_;
         QTimer *initialSyncTimer_;
 
+        //! Backoff of the failed sync requests.
+        RetryPolicy syncRetry_;
+        RetryPolicy initialSyncRetry_;
+
+        //! Saves the sync responses while the next sync is in flight.
+        QThreadPool *syncPool_;
+        //! Number of sync responses that haven't been saved yet.
+        int pendingSyncBatches_ = 0;
+        //! The token of the next sync, held back while too many responses are pending.
+        QString stalledNextBatch_;
+        //! Bumped when a response fails to be saved, so the queued ones are dropped.
+        std::atomic<int> syncGeneration_{0};
+        //! The responses are dropped until the sync restarts from the saved token.
+        std::atomic<bool> resyncPending_{false};
+
+        //! Saved sync responses that haven't been applied to the UI yet.
+        std::vector<SyncSnapshot> pendingSyncs_;
+        //! The room info updates of the pending responses, merged per room.
+        std::map<QString, RoomInfo> pendingRoomUpdates_;
+        QMutex pendingSyncsMutex_;
+
         QString current_room_;
         QString current_community_;
 
@@ -171,6 +214,12 @@ private:
 
         std::map<QString, QSharedPointer<Community>> communities_;
 
+        //! Rooms whose members have been requested.
+        std::set<QString> requestedMembers_;
+
+        //! The latest notification count of each room.
+        std::map<QString, uint16_t> notificationCounts_;
+
         // Keeps track of the users currently typing on each room.
         std::map<QString, QList<QString>> typingUsers_;
         QTimer *typingRefresher_;
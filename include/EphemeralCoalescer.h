@@ -0,0 +1,82 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <QObject>
+#include <QString>
+#include <QTimer>
+
+#include <functional>
+#include <map>
+
+//! Coalesces the outbound ephemeral traffic: read receipts & typing notifications.
+//!
+//! Only the latest receipt of each room is kept, and it's dropped if the server
+//! already has it. The typing state of a room is only sent when it changes, or when
+//! the previous notification is about to expire. Everything that's pending is sent
+//! together, shortly after the first request.
+class EphemeralCoalescer : public QObject
+{
+        Q_OBJECT
+
+public:
+        using ReceiptSender = std::function<void(const QString &room_id, const QString &event_id)>;
+        using TypingSender =
+          std::function<void(const QString &room_id, bool typing, int timeoutInMillis)>;
+
+        EphemeralCoalescer(ReceiptSender sendReceipt,
+                           TypingSender sendTyping,
+                           QObject *parent = nullptr);
+
+        void readEvent(const QString &room_id, const QString &event_id);
+        void setTyping(const QString &room_id, bool typing, int timeoutInMillis = 0);
+        //! Forget the pending requests & the state of the rooms, e.g on logout.
+        void clear();
+
+private:
+        struct TypingState
+        {
+                //! The state that was last sent.
+                bool typing = false;
+                //! Time (ms since epoch) the last typing notification was sent at.
+                qint64 sent = 0;
+                int timeout = 0;
+
+                //! The state that will be sent on the next flush.
+                bool requested = false;
+                bool pending   = false;
+        };
+
+        void flush();
+        void flushReceipts();
+        void flushTyping();
+        //! Whether the server already has a receipt of the user for the event.
+        bool isRead(const QString &room_id, const QString &event_id) const;
+
+        ReceiptSender sendReceipt_;
+        TypingSender sendTyping_;
+
+        //! The latest receipt that was requested per room.
+        std::map<QString, QString> pendingReceipts_;
+        //! The last receipt that was sent per room.
+        std::map<QString, QString> sentReceipts_;
+        std::map<QString, TypingState> typing_;
+
+        QTimer flushTimer_;
+};
@@ -0,0 +1,78 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <QFile>
+#include <QObject>
+#include <QString>
+#include <QUrl>
+
+#include "RetryPolicy.h"
+
+class QNetworkAccessManager;
+class QNetworkReply;
+
+//! Download of a file straight to disk.
+//!
+//! The body is written to `<filename>.part` as it arrives, with a bounded read buffer,
+//! and the file is moved into place once it's complete. Interrupted transfers are
+//! resumed from where they stopped with a Range request.
+//! The object deletes itself when the download is over.
+class FileDownload : public QObject
+{
+        Q_OBJECT
+
+public:
+        FileDownload(QNetworkAccessManager *manager,
+                     const QUrl &url,
+                     const QString &filename,
+                     QObject *parent = nullptr);
+
+        void start();
+
+public slots:
+        //! Stop the download and remove the partial file.
+        void cancel();
+
+signals:
+        //! `total` is -1 while the size is unknown.
+        void progress(qint64 received, qint64 total);
+        void finished(const QString &filename);
+        void failed(const QString &msg);
+
+private:
+        void sendRequest();
+        void readBody();
+        void replyFinished();
+        void abortReply();
+        void fail(const QString &msg);
+
+        QNetworkAccessManager *manager_;
+        QUrl url_;
+        QString filename_;
+        QFile part_;
+
+        QNetworkReply *reply_ = nullptr;
+
+        qint64 received_ = 0;
+        qint64 total_    = -1;
+        //! The current request asks for the rest of the file and no data has arrived yet.
+        bool rangeRequested_ = false;
+        //! Backoff of the consecutive attempts that failed.
+        RetryPolicy retry_;
+};
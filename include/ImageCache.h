@@ -0,0 +1,41 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <QImage>
+#include <QSize>
+#include <QString>
+
+//! Process wide cache of decoded images, bounded by a memory budget.
+//!
+//! The least recently used images are evicted first. Widgets should hold on to
+//! their images only while they're shown and get them back from here afterwards.
+//! It must only be used from the GUI thread.
+namespace imagecache {
+//! Identifies an image by its media url and the resolution (in device pixels) it was
+//! decoded at, so the same media shown at different sizes or screens is kept apart.
+QString
+key(const QString &url, const QSize &size);
+
+//! Returns a null image if the image isn't cached.
+QImage
+find(const QString &key);
+
+void
+insert(const QString &key, const QImage &img);
+}
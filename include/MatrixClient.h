@@ -20,21 +20,34 @@
 #include <QFileInfo>
 #include <QJsonDocument>
 #include <QNetworkAccessManager>
+#include <QNetworkDiskCache>
 #include <QNetworkReply>
 #include <QNetworkRequest>
+#include <QSize>
 #include <QUrl>
+#include <functional>
+#include <map>
 #include <memory>
 #include <mtx.hpp>
 #include <mtx/errors.hpp>
 
+#include "AvatarProvider.h"
+#include "EphemeralCoalescer.h"
+#include "FileDownload.h"
+#include "MediaScheduler.h"
+#include "RetryPolicy.h"
+#include "SyncSnapshot.h"
+#include "TlsSessionStore.h"
+#include "UploadQueue.h"
+
 class DownloadMediaProxy : public QObject
 {
         Q_OBJECT
 
 signals:
-        void imageDownloaded(const QPixmap &data);
-        void fileDownloaded(const QByteArray &data);
-        void avatarDownloaded(const QImage &img);
+        void imageDownloaded(const QImage &img);
+        //! The decoded avatar along with the original response.
+        void avatarDownloaded(const QImage &img, const QByteArray &data);
 };
 
 class StateEventProxy : public QObject
@@ -46,7 +59,30 @@ signals:
         void stateEventError(const QString &msg);
 };
 
-Q_DECLARE_METATYPE(mtx::responses::Sync)
+//! Set the protocol options of a request.
+void
+setupProtocol(QNetworkRequest &request);
+
+//! Connection pool for a class of traffic, with its own per-host connection budget,
+//! so that e.g bulk media downloads can't delay the sync or sending messages.
+class NetworkLane : public QNetworkAccessManager
+{
+public:
+        NetworkLane(TlsSessionStore *sessions, QObject *parent = nullptr);
+
+protected:
+        QNetworkReply *createRequest(Operation op,
+                                     const QNetworkRequest &req,
+                                     QIODevice *outgoingData = nullptr) override;
+
+private:
+        TlsSessionStore *sessions_;
+};
+
+//! Membership events of a room, as returned by /members.
+using RoomMembers = std::vector<mtx::events::StateEvent<mtx::events::state::Member>>;
+
+Q_DECLARE_METATYPE(RoomMembers)
 
 /*
  * MatrixClient provides the high level API to communicate with
@@ -78,14 +114,23 @@ public:
                           const QString &server,
                           const QString &session = "") noexcept;
         void versions() noexcept;
-        void fetchRoomAvatar(const QString &roomid, const QUrl &avatar_url);
+        void fetchRoomAvatar(const QString &roomid, const QUrl &avatar_url, AvatarTier tier);
         //! Download user's avatar.
-        QSharedPointer<DownloadMediaProxy> fetchUserAvatar(const QUrl &avatarUrl);
-        void fetchCommunityAvatar(const QString &communityId, const QUrl &avatarUrl);
+        QSharedPointer<DownloadMediaProxy> fetchUserAvatar(const QUrl &avatarUrl, AvatarTier tier);
+        void fetchCommunityAvatar(const QString &communityId,
+                                  const QUrl &avatarUrl,
+                                  AvatarTier tier);
         void fetchCommunityProfile(const QString &communityId);
         void fetchCommunityRooms(const QString &communityId);
-        QSharedPointer<DownloadMediaProxy> downloadImage(const QUrl &url);
-        QSharedPointer<DownloadMediaProxy> downloadFile(const QUrl &url);
+        //! Download an image, decoded to fit into `size` (or at full size if it's invalid).
+        QSharedPointer<DownloadMediaProxy> downloadImage(
+          const QUrl &url,
+          const QSize &size                 = QSize(),
+          MediaScheduler::Priority priority = MediaScheduler::Priority::Normal);
+        //! Download a file to disk. It starts once control returns to the event loop.
+        FileDownload *downloadFile(const QUrl &url, const QString &filename);
+        //! Url of a server generated thumbnail of the given mxc:// content.
+        QUrl thumbnailUrl(const QUrl &mxc, const QSize &size, const QString &method = "scale");
         void messages(const QString &room_id, const QString &from_token, int limit = 30) noexcept;
         void uploadImage(const QString &roomid,
                          const QString &filename,
@@ -108,18 +153,36 @@ public:
         void redactEvent(const QString &room_id, const QString &event_id);
         void inviteUser(const QString &room_id, const QString &user);
         void createRoom(const mtx::requests::CreateRoom &request);
+        //! Retrieve the notifications that arrived since the last time.
         void getNotifications() noexcept;
+        //! Retrieve the members of a room, which aren't included in the sync due to lazy loading.
+        void getRoomMembers(const QString &room_id) noexcept;
 
         QUrl getHomeServer() { return server_; };
+        MediaScheduler *media() { return media_; };
+        //! Whether there are uploads that haven't finished yet.
+        bool isUploading() const { return !uploads_->isEmpty(); };
         int transactionId() { return txn_id_; };
-        int incrementTransactionId() { return ++txn_id_; };
+        int incrementTransactionId();
+        //! Continue from the transaction id that was saved in the cache, unless the
+        //! one reserved in the settings is higher (e.g the cache was wiped).
+        void restoreTransactionId(int txn_id);
 
         void reset() noexcept;
 
+protected:
+        QNetworkReply *createRequest(Operation op,
+                                     const QNetworkRequest &req,
+                                     QIODevice *outgoingData = nullptr) override;
+
 public slots:
         void getOwnProfile() noexcept;
         void getOwnCommunities() noexcept;
         void logout() noexcept;
+        //! Open the connections to the homeserver ahead of the first requests.
+        void prewarmConnections() noexcept;
+        //! Abort the uploads that are in progress.
+        void cancelUploads();
 
         void setServer(const QString &server)
         {
@@ -147,6 +210,8 @@ signals:
                              const QString &token);
         void versionSuccess();
         void uploadFailed(int statusCode, const QString &msg);
+        void uploadCanceled();
+        void uploadProgress(qint64 sent, qint64 total);
         void imageUploaded(const QString &roomid,
                            const QString &filename,
                            const QString &url,
@@ -179,15 +244,20 @@ signals:
         // Returned profile data for the user's account.
         void getOwnProfileResponse(const QUrl &avatar_url, const QString &display_name);
         void getOwnCommunitiesResponse(const QList<QString> &own_communities);
-        void initialSyncCompleted(const mtx::responses::Sync &response);
-        void initialSyncFailed(int status_code = -1);
-        void syncCompleted(const mtx::responses::Sync &response);
-        void syncFailed(const QString &msg);
+        void initialSyncCompleted(const SyncSnapshot &response);
+        //! `server_delay` is the delay (in ms) requested by the server before retrying, or -1.
+        void initialSyncFailed(int status_code = -1, int server_delay = -1);
+        void syncCompleted(const SyncSnapshot &response);
+        void syncFailed(int server_delay = -1);
         void joinFailed(const QString &msg);
         void messageSent(const QString &event_id, const QString &roomid, int txn_id);
-        void messageSendFailed(const QString &roomid, int txn_id);
+        //! `retry_delay` is the delay (in ms) before the message should be sent again.
+        void messageSendFailed(const QString &roomid, int txn_id, int retry_delay);
+        //! The server refused the message, sending it again won't help.
+        void messageSendRejected(const QString &roomid, int txn_id, const QString &error);
         void emoteSent(const QString &event_id, const QString &roomid, int txn_id);
         void messagesRetrieved(const QString &room_id, const mtx::responses::Messages &msgs);
+        void messagesFailed(const QString &room_id);
         void joinedRoom(const QString &room_id);
         void leftRoom(const QString &room_id);
         void roomCreationFailed(const QString &msg);
@@ -197,10 +267,44 @@ signals:
         void invalidToken();
         void syncError(const QString &error);
         void notificationsRetrieved(const mtx::responses::Notifications &notifications);
+        void roomMembersRetrieved(const QString &room_id, const RoomMembers &members);
+        void roomMembersFailed(const QString &room_id);
 
 private:
+        using CachedHandler    = std::function<void(const QByteArray &data)>;
+        using CacheMissHandler = std::function<void(QNetworkReply *reply)>;
+
+        enum class CachePolicy
+        {
+                //! Serve the cached response right away, then revalidate it.
+                StaleWhileRevalidate,
+                //! Serve the cached response only once the server confirmed it (304).
+                Revalidate,
+        };
+
+        //! GET a resource through the http cache.
+        //!
+        //! With StaleWhileRevalidate the handler is called with the cached response right
+        //! away (if there is one) and again with the response of the revalidation, unless
+        //! it didn't change. The error handler is only called for failures that couldn't
+        //! be covered by the cache.
+        //!
+        //! With Revalidate exactly one of the handlers is called, after the server replied.
+        void cachedGet(QNetworkRequest request,
+                       CachedHandler handler,
+                       CacheMissHandler onError = nullptr,
+                       CachePolicy policy      = CachePolicy::StaleWhileRevalidate);
+        //! Start streaming the device to the media repository.
         QNetworkReply *makeUploadRequest(QSharedPointer<QIODevice> iodev);
-        QJsonObject getUploadReply(QNetworkReply *reply);
+        //! The requests behind the coalesced read receipts & typing notifications.
+        void sendReadMarkers(const QString &room_id, const QString &event_id);
+        void sendTypingState(const QString &room_id, bool typing, int timeoutInMillis);
+        //! Collect the body of the reply while it's being received.
+        QSharedPointer<QByteArray> bufferReply(QNetworkReply *reply);
+        //! Retrieve a page of notifications, continuing to the older ones
+        //! until the newest notification that's already known.
+        void fetchNotifications(const QString &from, uint64_t since, int page) noexcept;
+        void finishNotifications() noexcept;
         void setupAuth(QNetworkRequest &req)
         {
                 req.setRawHeader("Authorization", QString("Bearer %1").arg(token_).toLocal8Bit());
@@ -220,6 +324,13 @@ private:
 
         // Increasing transaction ID.
         int txn_id_;
+        //! The transaction ids up to this one are reserved in the cache.
+        int reserved_txn_id_ = 0;
+
+        //! Whether the notifications are being retrieved.
+        bool fetchingNotifications_ = false;
+        //! New notifications arrived while they were being retrieved.
+        bool notificationsOutdated_ = false;
 
         //! Token to be used for the next sync.
         QString next_batch_;
@@ -227,6 +338,27 @@ private:
         QString serverProtocol_;
         //! Filter to be send as filter-param for (initial) /sync requests.
         QString filter_;
+        //! Filter for the initial sync, which only carries the latest event of each room.
+        QString initial_filter_;
+
+        //! TLS session tickets shared by all the connections to the homeserver.
+        TlsSessionStore tlsSessions_;
+        //! The long-polling /sync requests.
+        NetworkLane *syncLane_;
+        //! Media downloads & uploads.
+        NetworkLane *mediaLane_;
+        //! Coalesces & prioritizes the media downloads.
+        MediaScheduler *media_;
+        //! Number of requests initiated by the user that haven't finished yet.
+        int interactiveRequests_ = 0;
+        //! Responses of the endpoints that are served through cachedGet.
+        QNetworkDiskCache *httpCache_;
+        //! Media uploads.
+        UploadQueue *uploads_;
+        //! Backoff of the message sends of each room.
+        std::map<QString, RetryPolicy> sendRetry_;
+        //! Read receipts & typing notifications.
+        EphemeralCoalescer *ephemeral_;
 };
 
 namespace http {
@@ -0,0 +1,132 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <QImage>
+#include <QObject>
+#include <QPointer>
+#include <QSize>
+#include <QUrl>
+
+#include <functional>
+#include <map>
+#include <vector>
+
+#include "RetryPolicy.h"
+
+class QNetworkAccessManager;
+class QNetworkReply;
+
+//! Schedules the media downloads.
+//!
+//! Requests are identified by their url, which encodes both the media id and the
+//! requested size. Identical requests are coalesced and the response is delivered to
+//! every waiter. Pending requests are started by priority, with a cap on the number
+//! of concurrent downloads, and are cancelled when all of their receivers are gone.
+//! Transient failures are retried a few times with backoff.
+class MediaScheduler : public QObject
+{
+        Q_OBJECT
+
+public:
+        enum class Priority
+        {
+                //! e.g prefetching of items that aren't on screen.
+                Background,
+                Normal,
+                //! The media is needed for something that is currently visible.
+                Visible,
+        };
+
+        using Callback      = std::function<void(const QByteArray &data)>;
+        using ImageCallback = std::function<void(const QImage &img, const QByteArray &data)>;
+
+        MediaScheduler(QNetworkAccessManager *manager, QObject *parent = nullptr);
+
+        //! Download the media. The callback is invoked with the response body,
+        //! unless the receiver has been destroyed by then. Failures are only logged.
+        void fetch(const QUrl &url,
+                   QObject *receiver,
+                   Callback callback,
+                   Priority priority = Priority::Normal);
+        //! Download & decode an image. The image is decoded on the thread pool, straight
+        //! to the resolution that fits into `size` (or at its full size if `size` is invalid).
+        void fetchImage(const QUrl &url,
+                        QObject *receiver,
+                        const QSize &size,
+                        ImageCallback callback,
+                        Priority priority = Priority::Normal);
+        //! Raise the priority of a request that hasn't started yet.
+        void prioritize(const QUrl &url, Priority priority = Priority::Visible);
+        //! Start fewer downloads, and none in the background, while more
+        //! important requests are in flight on other connections.
+        void holdBack(bool hold);
+
+private:
+        struct Waiter
+        {
+                QPointer<QObject> receiver;
+                //! Identifies the waiter while the receiver is being destroyed.
+                const QObject *id;
+                Callback callback;
+                //! Set instead of the callback for waiters that expect a decoded image.
+                ImageCallback imageCallback;
+                QSize size;
+                //! Removes the waiter when the receiver is destroyed.
+                QMetaObject::Connection destroyed;
+        };
+
+        struct Request
+        {
+                QUrl url;
+                Priority priority = Priority::Background;
+                //! Order of arrival, among requests of the same priority.
+                quint64 sequence = 0;
+                std::vector<Waiter> waiters;
+                QNetworkReply *reply = nullptr;
+                //! Number of failed attempts.
+                int failures = 0;
+                //! Waiting to be retried.
+                bool delayed = false;
+        };
+
+        //! Start pending requests while there are free slots.
+        void dispatch();
+        void start(const QString &key, Request &request);
+        void finished(const QString &key, QNetworkReply *reply);
+        void retry(const QString &key, Request &request, QNetworkReply *reply);
+        void enqueue(const QUrl &url, Waiter waiter, Priority priority);
+        //! Decode the image once for all the waiters that requested the same size.
+        void decode(const QByteArray &data, const QSize &size, std::vector<Waiter> waiters);
+        void removeWaiter(const QString &key, const QObject *receiver);
+        //! Stop tracking the receivers of the waiters that are done.
+        static void release(const std::vector<Waiter> &waiters);
+
+        QNetworkAccessManager *manager_;
+        std::map<QString, Request> requests_;
+
+        int active_       = 0;
+        quint64 sequence_ = 0;
+
+        //! Backoff & circuit breaking of the media repository.
+        RetryPolicy retry_;
+        //! Whether a dispatch is scheduled for when the circuit closes.
+        bool dispatchScheduled_ = false;
+        bool heldBack_          = false;
+};
@@ -0,0 +1,72 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <QByteArray>
+#include <QtGlobal>
+
+class QNetworkReply;
+
+//! Decides when a failed request should be retried.
+//!
+//! The delay grows exponentially with the number of consecutive failures and is
+//! picked at random from the whole interval (full jitter), so that clients which
+//! failed together, e.g because the homeserver restarted, don't retry in lockstep.
+//! A delay requested by the server always takes precedence.
+//!
+//! Each endpoint has its own policy, which also acts as a circuit breaker: after a
+//! number of consecutive failures the circuit opens and no request should be made
+//! until it closes again.
+class RetryPolicy
+{
+public:
+        RetryPolicy(int baseDelay,
+                    int maxDelay,
+                    int failureThreshold = 5,
+                    int openDuration     = 60 * 1000);
+
+        //! Record a failure and return the delay (in ms) before the next attempt.
+        //! `serverDelay` is the delay requested by the server, if any.
+        int failed(int serverDelay = -1);
+        int failed(QNetworkReply *reply, const QByteArray &body = QByteArray());
+        void succeeded();
+
+        //! Whether requests should be held back, as they're expected to fail.
+        bool isOpen() const;
+        //! Time (in ms) until the circuit closes.
+        int remaining() const;
+
+        int failures() const { return failures_; }
+
+        //! The delay (in ms) requested by the server through the Retry-After header
+        //! or the `retry_after_ms` of a M_LIMIT_EXCEEDED error. -1 if there is none.
+        static int serverDelay(QNetworkReply *reply, const QByteArray &body = QByteArray());
+        //! Whether the failure is transient: network errors, rate limiting & server errors.
+        static bool isTransient(QNetworkReply *reply);
+
+private:
+        int baseDelay_;
+        int maxDelay_;
+        int failureThreshold_;
+        int openDuration_;
+
+        int failures_ = 0;
+        //! Time (ms since epoch) the circuit closes at.
+        qint64 openUntil_ = 0;
+};
@@ -0,0 +1,68 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <QByteArray>
+
+#include <mtx/responses.hpp>
+
+namespace syncparser {
+
+//! The section of `rooms` a room payload was found in.
+enum class Section
+{
+        Join,
+        Invite,
+        Leave,
+};
+
+//! Location of a single room's payload inside the raw response.
+struct RoomSlice
+{
+        Section section;
+        std::string room_id;
+        const char *begin;
+        const char *end;
+};
+
+//! Result of the scan over the raw response.
+struct ScanResult
+{
+        //! Everything outside of `rooms` (next_batch, presence etc.).
+        json rest;
+        std::vector<RoomSlice> rooms;
+};
+
+//! Split a raw /sync response into the per-room byte ranges without building a DOM.
+//!
+//! The returned slices point into `data`, which must outlive them.
+//! Throws std::invalid_argument on malformed input.
+ScanResult
+scan(const QByteArray &data);
+
+//! Deserialize a /sync response.
+//!
+//! The rooms are decoded concurrently on the global thread pool and only
+//! the JSON of the rooms being decoded is materialized at any given time,
+//! instead of the DOM of the whole response.
+mtx::responses::Sync
+parse(const QByteArray &data);
+}
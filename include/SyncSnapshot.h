@@ -0,0 +1,46 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <QSharedPointer>
+
+#include <mtx/responses.hpp>
+
+//! Immutable sync response, shared between the processing stages.
+//!
+//! Passing it around (including through queued connections) only copies the pointer.
+using SyncSnapshot = QSharedPointer<const mtx::responses::Sync>;
+
+Q_DECLARE_METATYPE(SyncSnapshot)
+
+namespace snapshot {
+//! Take ownership of a sync response.
+SyncSnapshot
+create(mtx::responses::Sync &&res);
+
+//! Debug builds: count the rooms a consumer receives that aren't part of a live snapshot,
+//! i.e. copies made somewhere between the parser & that consumer.
+void
+checkShared(const mtx::responses::Rooms &rooms, const char *consumer);
+void
+checkShared(const mtx::responses::JoinedRoom &room, const char *consumer);
+
+//! Number of copied rooms detected so far. Always 0 in release builds.
+uint64_t
+roomCopies();
+}
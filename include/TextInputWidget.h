@@ -24,6 +24,7 @@
 #include <QApplication>
 #include <QDebug>
 #include <QHBoxLayout>
+#include <QLabel>
 #include <QPaintEvent>
 #include <QTextEdit>
 #include <QWidget>
@@ -111,7 +112,9 @@ private:
         int atTriggerPosition_ = -1;
 
         void textChanged();
-        void uploadData(const QByteArray data, const QString &media, const QString &filename);
+        void uploadData(const QSharedPointer<QIODevice> data,
+                        const QString &media,
+                        const QString &filename);
         void afterCompletion(int);
         void showPreview(const QMimeData *source, const QStringList &formats);
 };
@@ -133,6 +136,7 @@ public:
 public slots:
         void openFileSelection();
         void hideUploadSpinner();
+        void showUploadProgress(qint64 sent, qint64 total);
         void focusLineEdit() { input_->setFocus(); }
 
 private slots:
@@ -146,6 +150,8 @@ signals:
         void uploadFile(const QSharedPointer<QIODevice> data, const QString &filename);
         void uploadAudio(const QSharedPointer<QIODevice> data, const QString &filename);
         void uploadVideo(const QSharedPointer<QIODevice> data, const QString &filename);
+        //! The user clicked on the upload spinner.
+        void cancelUpload();
 
         void sendJoinRoomRequest(const QString &room);
 
@@ -164,6 +170,8 @@ private:
         FilteredTextEdit *input_;
 
         LoadingIndicator *spinner_;
+        //! Percentage of the current upload, shown next to the spinner.
+        QLabel *uploadProgress_;
 
         FlatButton *sendFileBtn_;
         FlatButton *sendMessageBtn_;
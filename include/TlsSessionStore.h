@@ -0,0 +1,73 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+#include <QtGlobal>
+
+class QNetworkReply;
+class QNetworkRequest;
+class QSslConfiguration;
+
+//! Keeps the TLS session ticket of the homeserver, so that the connections can
+//! resume the previous session instead of performing a full handshake.
+//!
+//! The ticket is persisted in a file that's only accessible by the user, to be
+//! reused after a restart. The latest ticket is kept in memory; the file is only
+//! written for the first ticket of a host (or once the saved one has expired)
+//! and on flush().
+//!
+//! TLS 1.3 tickets are meant to be used once, so the resumption mostly benefits
+//! the first connection to the host; the rest may fall back to a full handshake.
+class TlsSessionStore
+{
+public:
+        explicit TlsSessionStore(const QString &path);
+
+        //! Enable session resumption for the request & attach the known ticket of its host.
+        void apply(QNetworkRequest &request) const;
+        //! The TLS configuration to connect to the host with.
+        QSslConfiguration configuration(const QString &host) const;
+        //! Keep the ticket that the server issued on the connection of the reply.
+        void track(QNetworkReply *reply);
+        //! Write the latest ticket to the file, if it wasn't saved yet (e.g on shutdown).
+        void flush();
+        //! Forget the ticket, e.g on logout.
+        void clear();
+
+private:
+        void load();
+        void update(const QString &host, const QByteArray &ticket, int lifetimeHint);
+        void save();
+        bool isValid(const QString &host) const;
+
+        QString path_;
+
+        QString host_;
+        QByteArray ticket_;
+        //! Time (ms since epoch) the ticket expires at.
+        qint64 expires_ = 0;
+
+        //! The host & the expiration of the ticket in the file.
+        QString savedHost_;
+        qint64 savedExpires_ = 0;
+        //! The ticket in memory is newer than the one in the file.
+        bool dirty_ = false;
+};
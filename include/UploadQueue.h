@@ -0,0 +1,107 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <QByteArray>
+#include <QObject>
+#include <QSharedPointer>
+#include <QString>
+
+#include <functional>
+#include <map>
+
+class QIODevice;
+class QNetworkReply;
+
+//! Schedules the media uploads.
+//!
+//! A limited number of uploads run in parallel, while the results are delivered
+//! in the order the uploads were queued for each room, so the resulting messages
+//! keep the order the user picked. Content that has been uploaded before (identified
+//! by its sha256) isn't sent again, the existing content uri is reused instead.
+class UploadQueue : public QObject
+{
+        Q_OBJECT
+
+public:
+        //! Start sending the content. Returns nullptr if the upload couldn't be started.
+        using Sender = std::function<QNetworkReply *(QSharedPointer<QIODevice> data)>;
+        using Callback = std::function<void(const QString &url, const QString &mime, qint64 size)>;
+
+        UploadQueue(Sender sender, QObject *parent = nullptr);
+
+        //! Queue the content of the device for upload. The callback isn't invoked
+        //! if the upload fails or is canceled.
+        void enqueue(const QString &roomid, QSharedPointer<QIODevice> data, Callback callback);
+        //! Abort the running uploads & drop the queued ones.
+        void cancel();
+
+        bool isEmpty() const { return jobs_.empty(); }
+
+signals:
+        void failed(int statusCode, const QString &msg);
+        void canceled();
+        //! Combined progress of the running uploads.
+        void progress(qint64 sent, qint64 total);
+
+private:
+        enum class State
+        {
+                //! The content hash is being calculated.
+                Hashing,
+                Pending,
+                Active,
+                //! Uploaded, but an earlier upload of the room hasn't finished yet.
+                Done,
+        };
+
+        struct Job
+        {
+                QString roomid;
+                QSharedPointer<QIODevice> data;
+                Callback callback;
+                State state = State::Hashing;
+                QByteArray hash;
+                QNetworkReply *reply = nullptr;
+                qint64 sent          = 0;
+                qint64 total         = 0;
+
+                QString url;
+                QString mime;
+                qint64 size = 0;
+        };
+
+        void hashed(quint64 id, const QByteArray &hash);
+        //! Start pending uploads while there are free slots.
+        void dispatch();
+        void start(quint64 id, Job &job);
+        void finished(quint64 id, QNetworkReply *reply);
+        void fail(quint64 id, int statusCode, const QString &msg);
+        //! Invoke the callbacks of the room's uploads that are done, up to the first
+        //! one that isn't.
+        void deliver(const QString &roomid);
+        void updateProgress();
+
+        Sender sender_;
+        //! Keyed by the order of arrival.
+        std::map<quint64, Job> jobs_;
+
+        int active_       = 0;
+        quint64 sequence_ = 0;
+};
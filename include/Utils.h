@@ -33,6 +33,10 @@ firstChar(const QString &input);
 QString
 humanReadableFileSize(uint64_t bytes);
 
+//! Human readable progress of a transfer. A negative total means it's unknown.
+QString
+transferProgress(qint64 transferred, qint64 total);
+
 QString
 event_body(const mtx::events::collections::TimelineEvents &event);
 
@@ -94,6 +98,11 @@ createDescriptionInfo(const Event &event, const QString &localUser, const QStrin
           ts};
 }
 
+//! The size that an image of the given size will have after being scaled down
+//! to fit to the given width & height limitations.
+QSize
+scaledSize(uint64_t max_width, uint64_t max_height, const QSize &source);
+
 //! Scale down an image to fit to the given width & height limitations.
 template<class ImageType>
 ImageType
@@ -102,24 +111,9 @@ scaleDown(uint64_t max_width, uint64_t max_height, const ImageType &source)
         if (source.isNull())
                 return QPixmap();
 
-        auto width_ratio  = (double)max_width / (double)source.width();
-        auto height_ratio = (double)max_height / (double)source.height();
-
-        auto min_aspect_ratio = std::min(width_ratio, height_ratio);
-
-        int final_width  = 0;
-        int final_height = 0;
+        const auto size = scaledSize(max_width, max_height, source.size());
 
-        if (min_aspect_ratio > 1) {
-                final_width  = source.width();
-                final_height = source.height();
-        } else {
-                final_width  = source.width() * min_aspect_ratio;
-                final_height = source.height() * min_aspect_ratio;
-        }
-
-        return source.scaled(
-          final_width, final_height, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+        return source.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
 }
 
 //! Delete items in a container based on a predicate.
@@ -159,6 +153,12 @@ event_sender(const mtx::events::collections::TimelineEvents &event)
         return mpark::visit([](auto msg) { return QString::fromStdString(msg.sender); }, event);
 }
 
+inline uint64_t
+event_timestamp(const mtx::events::collections::TimelineEvents &event)
+{
+        return mpark::visit([](const auto &msg) { return msg.origin_server_ts; }, event);
+}
+
 template<class T>
 QString
 message_body(const mtx::events::collections::TimelineEvents &event)
@@ -29,6 +29,9 @@ class ImageOverlay : public QWidget
 public:
         ImageOverlay(QPixmap image, QWidget *parent = nullptr);
 
+        //! Replace the displayed image (e.g the preview with the original).
+        void setImage(const QPixmap &image);
+
 protected:
         void mousePressEvent(QMouseEvent *event) override;
         void paintEvent(QPaintEvent *event) override;
@@ -37,6 +40,9 @@ signals:
         void closing();
 
 private:
+        //! Scale the image once, instead of on every paint.
+        void scaleImage();
+
         QPixmap originalImage_;
         QPixmap image_;
 
@@ -20,10 +20,12 @@
 #include <QLabel>
 #include <QLineEdit>
 #include <QPixmap>
+#include <QSharedPointer>
 #include <QWidget>
 
 #include "FlatButton.h"
 
+class QIODevice;
 class QMimeData;
 
 namespace dialogs {
@@ -38,15 +40,20 @@ public:
         void setPreview(const QString &path);
 
 signals:
-        void confirmUpload(const QByteArray data, const QString &media, const QString &filename);
+        void confirmUpload(const QSharedPointer<QIODevice> data,
+                           const QString &media,
+                           const QString &filename);
 
 private:
         void init();
         void setLabels(const QString &type, const QString &mime, uint64_t upload_size);
+        //! The device the upload will be streamed from.
+        QSharedPointer<QIODevice> device() const;
 
         bool isImage_;
         QPixmap image_;
 
+        //! Only used for pasted media, files are read from disk while being uploaded.
         QByteArray data_;
         QString filePath_;
         QString mediaType_;
@@ -193,6 +193,8 @@ public:
         QString eventId() const { return event_id_; }
         void setEventId(const QString &event_id) { event_id_ = event_id; }
         void markReceived();
+        //! The message couldn't be sent.
+        void markFailed(const QString &error);
         void setRoomId(QString room_id) { room_id_ = room_id; }
         void sendReadReceipt() const
         {
@@ -49,6 +49,8 @@ struct PendingMessage
         uint64_t media_size;
         QString event_id;
         TimelineItem *widget;
+        //! The request that sends the message is in progress (or waiting to be retried).
+        bool sending = false;
 
         PendingMessage(mtx::events::MessageType ty,
                        int txn_id,
@@ -122,19 +124,25 @@ public:
 
         // Add new events at the end of the timeline.
         void addEvents(const mtx::responses::Timeline &timeline);
-        void addUserMessage(mtx::events::MessageType ty, const QString &msg);
+        //! Display & send a message of the user. A new transaction id is used,
+        //! unless the message is restored from the outbox.
+        void addUserMessage(mtx::events::MessageType ty, const QString &msg, int txn_id = -1);
 
         template<class Widget, mtx::events::MessageType MsgType>
         void addUserMessage(const QString &url,
                             const QString &filename,
                             const QString &mime,
-                            uint64_t size);
+                            uint64_t size,
+                            int txn_id = -1);
         void updatePendingMessage(int txn_id, QString event_id);
         void scrollDown();
         QLabel *createDateSeparator(QDateTime datetime);
 
         //! Remove an item from the timeline with the given Event ID.
         void removeEvent(const QString &event_id);
+        //! Retrieve the next batch of history in the background, without rendering it.
+        //! Returns false if there was nothing to retrieve.
+        bool prefetchHistory();
 
 public slots:
         void sliderRangeChanged(int min, int max);
@@ -147,7 +155,9 @@ public slots:
         // Whether or not the initial batch has been loaded.
         bool hasLoaded() { return scroll_layout_->count() > 1 || isTimelineFinished; }
 
-        void handleFailedMessage(int txnid);
+        void handleFailedMessage(int txnid, int retry_delay);
+        //! Give up on a message the server refused.
+        void handleRejectedMessage(int txnid, const QString &error);
 
 private slots:
         void sendNextPendingMessage();
@@ -197,6 +207,9 @@ private:
         void saveMessageInfo(const QString &sender,
                              uint64_t origin_server_ts,
                              TimelineDirection direction);
+        //! Request the room members if the sender wasn't part of the (lazy loaded) state.
+        //! Deferred until the room is opened.
+        void loadUnknownMember(const QString &sender);
 
         TimelineEvent findFirstViewableEvent(const std::vector<TimelineEvent> &events);
         TimelineEvent findLastViewableEvent(const std::vector<TimelineEvent> &events);
@@ -236,6 +249,9 @@ private:
         bool isDuplicate(const QString &event_id) { return eventIds_.contains(event_id); }
 
         void handleNewUserMessage(PendingMessage msg);
+        void sendPendingMessage(const PendingMessage &msg);
+        //! Mark the sent messages at the head of the queue as received.
+        void confirmPendingMessages();
         bool isDateDifference(const QDateTime &first,
                               const QDateTime &second = QDateTime::currentDateTime()) const;
 
@@ -260,6 +276,8 @@ private:
         QString local_user_;
 
         bool isPaginationInProgress_ = false;
+        //! Senders were found while hidden that aren't in the members of the room.
+        bool hasUnknownMembers_ = false;
 
         // Keeps track whether or not the user has visited the view.
         bool isInitialized      = false;
@@ -292,6 +310,8 @@ private:
 
         // The events currently rendered. Used for duplicate detection.
         QMap<QString, TimelineItem *> eventIds_;
+        //! Messages that haven't been confirmed yet, in the order they were sent.
+        //! Several of them are sent concurrently, but they're confirmed in order.
         QQueue<PendingMessage> pending_msgs_;
         QList<PendingMessage> pending_sent_msgs_;
 };
@@ -301,7 +321,8 @@ void
 TimelineView::addUserMessage(const QString &url,
                              const QString &filename,
                              const QString &mime,
-                             uint64_t size)
+                             uint64_t size,
+                             int txn_id)
 {
         auto with_sender = (lastSender_ != local_user_) || isDateDifference(lastMsgTimestamp_);
         auto trimmed     = QFileInfo{filename}.fileName(); // Trim file path.
@@ -320,7 +341,8 @@ TimelineView::addUserMessage(const QString &url,
         // Keep track of the sender and the timestamp of the current message.
         saveLastMessageInfo(local_user_, QDateTime::currentDateTime());
 
-        int txn_id = http::client()->incrementTransactionId();
+        if (txn_id == -1)
+                txn_id = http::client()->incrementTransactionId();
 
         PendingMessage message(MsgType, txn_id, url, trimmed, mime, size, "", view_item);
         handleNewUserMessage(message);
@@ -361,6 +383,7 @@ TimelineView::processMessageEvent(const Event &event, TimelineDirection directio
         auto with_sender = isSenderRendered(sender, event.origin_server_ts, direction);
 
         saveMessageInfo(sender, event.origin_server_ts, direction);
+        loadUnknownMember(sender);
 
         auto item = createTimelineItem<Event>(event, with_sender);
 
@@ -386,6 +409,7 @@ TimelineView::processMessageEvent(const Event &event, TimelineDirection directio
         auto with_sender = isSenderRendered(sender, event.origin_server_ts, direction);
 
         saveMessageInfo(sender, event.origin_server_ts, direction);
+        loadUnknownMember(sender);
 
         auto item = createTimelineItem<Event, Widget>(event, with_sender);
 
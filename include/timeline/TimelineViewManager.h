@@ -17,6 +17,11 @@
 
 #pragma once
 
+#include <deque>
+#include <map>
+#include <set>
+#include <vector>
+
 #include <QSharedPointer>
 #include <QStackedWidget>
 
@@ -44,7 +49,18 @@ public:
         void addRoom(const QString &room_id);
 
         void sync(const mtx::responses::Rooms &rooms);
-        void clearAll() { views_.clear(); }
+        //! Apply the timelines of several sync responses, in the order they were received.
+        void sync(
+          const std::map<QString, std::vector<const mtx::responses::JoinedRoom *>> &rooms);
+        //! Retrieve the recent history of the given rooms in the background,
+        //! a few rooms at a time and in the given order.
+        void backfill(const std::vector<std::string> &rooms);
+        void clearAll()
+        {
+                views_.clear();
+                backfillQueue_.clear();
+                backfillInFlight_.clear();
+        }
 
         // Check if all the timelines have been loaded.
         bool hasLoaded() const;
@@ -82,12 +98,24 @@ public slots:
 
 private slots:
         void messageSent(const QString &eventid, const QString &roomid, int txnid);
-        void messageSendFailed(const QString &roomid, int txnid);
+        void messageSendFailed(const QString &roomid, int txnid, int retry_delay);
+        void messageSendRejected(const QString &roomid, int txnid, const QString &error);
 
 private:
         //! Check if the given room id is managed by a TimelineView.
         bool timelineViewExists(const QString &id) { return views_.find(id) != views_.end(); }
+        //! Send again the messages that weren't confirmed before the last exit.
+        void restoreOutbox();
+        //! Start retrieving the history of the next rooms in the backfill queue.
+        void backfillNext();
+        //! The backfill of a room has finished (or failed).
+        void backfillDone(const QString &room_id);
 
         QString active_room_;
         std::map<QString, QSharedPointer<TimelineView>> views_;
+
+        //! Rooms waiting for their history to be retrieved.
+        std::deque<QString> backfillQueue_;
+        //! Rooms whose history is being retrieved.
+        std::set<QString> backfillInFlight_;
 };
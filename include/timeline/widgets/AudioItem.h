@@ -21,11 +21,14 @@
 #include <QIcon>
 #include <QMediaPlayer>
 #include <QMouseEvent>
+#include <QPointer>
 #include <QSharedPointer>
 #include <QWidget>
 
 #include <mtx.hpp>
 
+class FileDownload;
+
 class AudioItem : public QWidget
 {
         Q_OBJECT
@@ -71,7 +74,7 @@ protected:
 
 private:
         void init();
-        void fileDownloaded(const QByteArray &data);
+        void startDownload();
 
         enum class AudioState
         {
@@ -86,6 +89,11 @@ private:
         QString readableFileSize_;
         QString filenameToSave_;
 
+        //! The ongoing download of the file, if any.
+        QPointer<FileDownload> download_;
+        //! Shown instead of the file size while downloading.
+        QString progress_;
+
         mtx::events::RoomEvent<mtx::events::msg::Audio> event_;
 
         QMediaPlayer *player_;
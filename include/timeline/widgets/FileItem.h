@@ -20,11 +20,14 @@
 #include <QEvent>
 #include <QIcon>
 #include <QMouseEvent>
+#include <QPointer>
 #include <QSharedPointer>
 #include <QWidget>
 
 #include <mtx.hpp>
 
+class FileDownload;
+
 class FileItem : public QWidget
 {
         Q_OBJECT
@@ -60,13 +63,18 @@ protected:
 private:
         void openUrl();
         void init();
-        void fileDownloaded(const QByteArray &data);
+        void startDownload();
 
         QUrl url_;
         QString text_;
         QString readableFileSize_;
         QString filenameToSave_;
 
+        //! The ongoing download of the file, if any.
+        QPointer<FileDownload> download_;
+        //! Shown instead of the file size while downloading.
+        QString progress_;
+
         mtx::events::RoomEvent<mtx::events::msg::File> event_;
 
         QIcon icon_;
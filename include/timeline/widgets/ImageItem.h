@@ -24,6 +24,8 @@
 
 #include <mtx.hpp>
 
+#include "MediaScheduler.h"
+
 namespace dialogs {
 class ImageOverlay;
 }
@@ -52,12 +54,19 @@ protected:
         void paintEvent(QPaintEvent *event) override;
         void mousePressEvent(QMouseEvent *event) override;
         void resizeEvent(QResizeEvent *event) override;
+        void hideEvent(QHideEvent *event) override;
 
         //! Whether the user can interact with the displayed image.
         bool isInteractive_ = true;
 
 private:
         void openUrl();
+        //! Start downloading the preview of the image.
+        void loadThumbnail();
+        //! Get the preview from the image cache or download it.
+        void fetchThumbnail(MediaScheduler::Priority priority);
+        //! Scale the preview to the displayed size.
+        void scaleImage();
 
         int max_width_  = 500;
         int max_height_ = 300;
@@ -68,9 +77,23 @@ private:
         QPixmap scaled_image_;
         QPixmap image_;
 
+        //! Full resolution image.
         QUrl url_;
+        //! Preview at the displayed size.
+        QUrl thumbnail_url_;
+        //! Resolution of the preview in device pixels.
+        QSize thumbnail_size_;
+        QString cache_key_;
         QString text_;
 
+        //! Size of the image in the timeline, known ahead of the download from the event.
+        QSize reserved_size_;
+
+        //! Whether the download was moved to the front of the media queue.
+        bool prioritized_ = false;
+        //! Whether the images were released while the item was hidden.
+        bool released_ = false;
+
         int bottom_height_ = 30;
 
         QRectF textRegion_;
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <QColor>
+#include <QMouseEvent>
 #include <QPaintEvent>
 #include <QPainter>
 #include <QTimer>
@@ -26,6 +27,12 @@ public:
         int interval() { return interval_; }
         void setInterval(int interval) { interval_ = interval; }
 
+signals:
+        void clicked();
+
+protected:
+        void mousePressEvent(QMouseEvent *e) override;
+
 private slots:
         void onTimeout();
 
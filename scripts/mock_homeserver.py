@@ -0,0 +1,640 @@
+#!/usr/bin/env python3
+
+'''
+Local stand-in homeserver for exercising the client without a network.
+
+It serves synthetic (or recorded) responses for the endpoints the client
+uses: login, filters, /sync, /messages, /send, /members, /notifications,
+the typing & read marker endpoints and the media repository. The traffic can
+be shaped with latency, bandwidth and error injection, and the payloads can be
+scaled, so that the sync throughput, the retries and the media scheduling can
+be benchmarked reproducibly.
+
+The client only talks https, so a certificate has to be given:
+
+    openssl req -x509 -newkey rsa:2048 -nodes -days 365 -subj /CN=localhost \\
+        -keyout key.pem -out cert.pem
+    ./scripts/mock_homeserver.py --cert cert.pem --key key.pem --rooms 200
+    NHEKO_ALLOW_INSECURE_CONNECTIONS=1 nheko
+
+and the login is done as any user (e.g @bench:localhost) on localhost:8448
+with any password. A summary of the requests is printed on exit.
+'''
+
+import argparse
+import json
+import random
+import re
+import signal
+import ssl
+import struct
+import sys
+import threading
+import time
+import zlib
+
+from collections import defaultdict
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import parse_qs, unquote, urlparse
+
+
+CLIENT_API = '/_matrix/client/r0'
+MEDIA_API = '/_matrix/media/r0'
+
+# Size of the chunks the responses are written in, when the bandwidth is limited.
+CHUNK_SIZE = 16 * 1024
+
+
+def png(width, height, seed):
+    '''
+    Encode a solid colored PNG of the given size.
+    '''
+    def chunk(tag, data):
+        body = tag + data
+        return struct.pack('>I', len(data)) + body + struct.pack('>I', zlib.crc32(body))
+
+    rnd = random.Random(seed)
+    pixel = bytes([rnd.randrange(256), rnd.randrange(256), rnd.randrange(256)])
+    raw = b''.join(b'\x00' + pixel * width for _ in range(height))
+
+    return (b'\x89PNG\r\n\x1a\n' +
+            chunk(b'IHDR', struct.pack('>IIBBBBB', width, height, 8, 2, 0, 0, 0)) +
+            chunk(b'IDAT', zlib.compress(raw)) +
+            chunk(b'IEND', b''))
+
+
+class Homeserver(object):
+    '''
+    The state of the server: the rooms, their timelines and the media.
+
+    Every event gets a sequence number, which is also used as the sync token,
+    so an incremental sync returns the events after the given number.
+    '''
+
+    def __init__(self, args):
+        self.args = args
+        self.domain = args.domain
+        self.user_id = None
+        self.rnd = random.Random(args.seed)
+
+        self.cond = threading.Condition()
+        self.seq = 0
+        self.events = []
+        self.rooms = {}
+        self.filters = {}
+        self.media = {}
+        # Content of the media that wasn't uploaded, generated on the first download.
+        self.generated = {}
+        self.generated_lock = threading.Lock()
+        # Event ids of the sends by transaction id, as the retransmissions are idempotent.
+        self.transactions = {}
+
+        self.stats = defaultdict(lambda: [0, 0])
+        self.stats_lock = threading.Lock()
+
+        if args.sync_file:
+            with open(args.sync_file) as f:
+                self.recorded_sync = json.load(f)
+        else:
+            self.recorded_sync = None
+
+    def generate_media(self, media_id):
+        '''
+        Random content of the configured size, the same for every download of the id.
+        '''
+        with self.generated_lock:
+            if media_id not in self.generated:
+                size = self.args.media_size
+                bits = random.Random(media_id).getrandbits(8 * size) if size else 0
+                self.generated[media_id] = bits.to_bytes(size, 'little')
+
+            return self.generated[media_id]
+
+    def login(self, user):
+        if not user.startswith('@'):
+            user = '@%s:%s' % (user, self.domain)
+
+        with self.cond:
+            if self.user_id is None:
+                self.user_id = user
+                self.populate()
+
+        return self.user_id
+
+    def populate(self):
+        for i in range(self.args.rooms):
+            room_id = '!room%d:%s' % (i, self.domain)
+            members = [self.user_id] + ['@user%d:%s' % (m, self.domain)
+                                        for m in range(self.args.members)]
+
+            self.rooms[room_id] = {
+                'name': 'Room %d' % i,
+                'members': members,
+                'history': [self.message(room_id, self.rnd.choice(members))
+                            for _ in range(self.args.history)],
+            }
+
+        for room_id, room in self.rooms.items():
+            for _ in range(self.args.timeline):
+                self.append(room_id, self.message(room_id, self.rnd.choice(room['members'])))
+
+    def message(self, room_id, sender, content=None):
+        self.seq += 1
+
+        if content is None:
+            content = {'msgtype': 'm.text',
+                       'body': self.text(self.args.message_size)}
+
+        return {
+            'event_id': '$%d:%s' % (self.seq, self.domain),
+            'type': 'm.room.message',
+            'sender': sender,
+            'room_id': room_id,
+            'origin_server_ts': int(time.time() * 1000),
+            'content': content,
+            'unsigned': {'age': 0},
+        }
+
+    def text(self, size):
+        words = []
+        length = 0
+
+        while length < size:
+            word = ''.join(self.rnd.choice('abcdefghijklmnopqrstuvwxyz')
+                           for _ in range(self.rnd.randint(2, 9)))
+            words.append(word)
+            length += len(word) + 1
+
+        return ' '.join(words)[:size]
+
+    def append(self, room_id, event):
+        event['seq'] = self.seq
+        self.events.append(event)
+        self.cond.notify_all()
+
+    def state(self, room_id):
+        room = self.rooms[room_id]
+        creator = room['members'][0]
+
+        def state_event(kind, key, content, sender=creator):
+            return {'event_id': '$%s-%s-%s' % (room_id, kind, key), 'type': kind,
+                    'state_key': key, 'sender': sender, 'room_id': room_id,
+                    'origin_server_ts': 0, 'content': content}
+
+        events = [
+            state_event('m.room.create', '', {'creator': creator}),
+            state_event('m.room.name', '', {'name': room['name']}),
+            state_event('m.room.join_rules', '', {'join_rule': 'invite'}),
+            state_event('m.room.power_levels', '', {'users': {creator: 100}}),
+        ]
+
+        # The members are retrieved through /members, as the filter asks for lazy loading.
+        events.append(state_event('m.room.member', self.user_id,
+                                  {'membership': 'join', 'displayname': self.user_id},
+                                  self.user_id))
+
+        return events
+
+    def sync(self, since, timeout, limit):
+        if self.recorded_sync is not None and since is None:
+            body = dict(self.recorded_sync)
+            body['next_batch'] = 's%d' % self.seq
+            return body
+
+        with self.cond:
+            if since is not None:
+                # Long polling: wait for the events after the token.
+                deadline = time.time() + timeout / 1000.0
+                while self.seq <= since and time.time() < deadline:
+                    self.cond.wait(deadline - time.time())
+
+            start = since if since is not None else 0
+            new_events = [e for e in self.events if e['seq'] > start]
+            next_batch = 's%d' % self.seq
+
+        timelines = defaultdict(list)
+        for event in new_events:
+            timelines[event['room_id']].append(
+                {k: v for k, v in event.items() if k not in ('seq', 'room_id')})
+
+        join = {}
+        rooms = self.rooms if since is None else timelines
+
+        for room_id in rooms:
+            events = timelines.get(room_id, [])
+            limited = limit is not None and len(events) > limit
+
+            if limited:
+                events = events[-limit:]
+
+            join[room_id] = {
+                'state': {'events': self.state(room_id) if since is None else []},
+                'timeline': {'events': events, 'limited': limited,
+                             'prev_batch': 'h%s|%d' % (room_id, 0)},
+                'ephemeral': {'events': []},
+                'account_data': {'events': []},
+                'unread_notifications': {
+                    'highlight_count': 0,
+                    'notification_count': len(events) if since is not None else 0,
+                },
+            }
+
+        return {
+            'next_batch': next_batch,
+            'rooms': {'join': join, 'invite': {}, 'leave': {}},
+            'presence': {'events': []},
+            'account_data': {'events': []},
+            'to_device': {'events': []},
+        }
+
+    def messages(self, room_id, start, limit):
+        history = self.rooms[room_id]['history']
+        end = min(start + limit, len(history))
+        chunk = list(reversed(history))[start:end]
+
+        return {
+            'start': 'h%s|%d' % (room_id, start),
+            'end': 'h%s|%d' % (room_id, end),
+            'chunk': chunk,
+        }
+
+    def send(self, room_id, event_type, txn_id, content):
+        with self.cond:
+            if txn_id in self.transactions:
+                return self.transactions[txn_id]
+
+            event = self.message(room_id, self.user_id, content)
+            event['type'] = event_type
+            # Lets the client match the echo with the local copy of the message.
+            event['unsigned']['transaction_id'] = txn_id
+            self.append(room_id, event)
+
+            self.transactions[txn_id] = event['event_id']
+
+        return event['event_id']
+
+    def tick(self):
+        '''
+        Emulate the activity of the other members of the rooms.
+        '''
+        if not self.args.event_rate:
+            return
+
+        interval = 1.0 / self.args.event_rate
+
+        while True:
+            time.sleep(interval)
+
+            with self.cond:
+                if not self.rooms:
+                    continue
+
+                room_id = self.rnd.choice(list(self.rooms))
+                sender = self.rnd.choice(self.rooms[room_id]['members'])
+                self.append(room_id, self.message(room_id, sender))
+
+    def record(self, endpoint, size):
+        with self.stats_lock:
+            self.stats[endpoint][0] += 1
+            self.stats[endpoint][1] += size
+
+    def summary(self):
+        with self.stats_lock:
+            for endpoint, (count, size) in sorted(self.stats.items()):
+                print('%-40s %8d requests %12d bytes' % (endpoint, count, size))
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+
+    # (method, pattern, handler name). The first match wins.
+    routes = [
+        ('GET', r'/_matrix/client/versions$', 'versions'),
+        ('POST', CLIENT_API + r'/login$', 'login'),
+        ('POST', CLIENT_API + r'/logout$', 'empty'),
+        ('POST', CLIENT_API + r'/user/[^/]+/filter$', 'create_filter'),
+        ('GET', CLIENT_API + r'/sync$', 'sync'),
+        ('GET', CLIENT_API + r'/rooms/([^/]+)/messages$', 'messages'),
+        ('GET', CLIENT_API + r'/rooms/([^/]+)/members$', 'members'),
+        ('PUT', CLIENT_API + r'/rooms/([^/]+)/send/([^/]+)/([^/]+)$', 'send'),
+        ('PUT', CLIENT_API + r'/rooms/[^/]+/typing/[^/]+$', 'empty'),
+        ('POST', CLIENT_API + r'/rooms/[^/]+/read_markers$', 'empty'),
+        ('GET', CLIENT_API + r'/profile/([^/]+)$', 'profile'),
+        ('GET', CLIENT_API + r'/joined_groups$', 'joined_groups'),
+        ('GET', CLIENT_API + r'/notifications$', 'notifications'),
+        ('POST', MEDIA_API + r'/upload$', 'upload'),
+        ('GET', MEDIA_API + r'/thumbnail/[^/]+/([^/]+)$', 'thumbnail'),
+        ('GET', MEDIA_API + r'/download/[^/]+/([^/]+)', 'download'),
+    ]
+
+    def do_GET(self):
+        self.dispatch('GET')
+
+    def do_POST(self):
+        self.dispatch('POST')
+
+    def do_PUT(self):
+        self.dispatch('PUT')
+
+    def log_message(self, fmt, *args):
+        if self.server.hs.args.verbose:
+            super().log_message(fmt, *args)
+
+    def dispatch(self, method):
+        hs = self.server.hs
+        args = hs.args
+
+        url = urlparse(self.path)
+        self.query = {k: v[-1] for k, v in parse_qs(url.query).items()}
+
+        length = int(self.headers.get('Content-Length', 0))
+        self.body = self.rfile.read(length) if length else b''
+
+        for route_method, pattern, name in self.routes:
+            match = re.match(pattern, url.path)
+            if route_method == method and match:
+                break
+        else:
+            return self.error(404, 'M_UNRECOGNIZED', 'Unrecognized request')
+
+        endpoint = '%s %s' % (method, name)
+
+        delay = args.latency + hs.rnd.uniform(-args.jitter, args.jitter)
+        time.sleep(max(delay, 0) / 1000.0)
+
+        if re.search(args.error_endpoints, name) and hs.rnd.random() < args.error_rate:
+            status = hs.rnd.choice(args.error_status)
+            hs.record(endpoint + ' (error)', 0)
+
+            if status == 429:
+                return self.error(429, 'M_LIMIT_EXCEEDED', 'Too many requests',
+                                  retry_after_ms=args.retry_after)
+
+            return self.error(status, 'M_UNKNOWN', 'Injected failure')
+
+        try:
+            result = getattr(self, name)(*[unquote(g) for g in match.groups()])
+        except KeyError as e:
+            return self.error(404, 'M_NOT_FOUND', 'Unknown %s' % e)
+
+        # The handlers may add headers to the (status, content type, body) they return.
+        status, content_type, body = result[:3]
+        headers = result[3] if len(result) > 3 else None
+
+        hs.record(endpoint, len(body))
+        self.respond(status, content_type, body, headers)
+
+    def respond(self, status, content_type, body, headers=None):
+        self.send_response(status)
+        self.send_header('Content-Type', content_type)
+        self.send_header('Content-Length', str(len(body)))
+        for key, value in (headers or {}).items():
+            self.send_header(key, value)
+        self.end_headers()
+
+        bandwidth = self.server.hs.args.bandwidth
+
+        if not bandwidth:
+            self.wfile.write(body)
+            return
+
+        for offset in range(0, len(body), CHUNK_SIZE):
+            chunk = body[offset:offset + CHUNK_SIZE]
+            self.wfile.write(chunk)
+            self.wfile.flush()
+            time.sleep(len(chunk) / float(bandwidth))
+
+    def error(self, status, errcode, message, retry_after_ms=None):
+        payload = {'errcode': errcode, 'error': message}
+        headers = {}
+
+        if retry_after_ms is not None:
+            payload['retry_after_ms'] = retry_after_ms
+            headers['Retry-After'] = str(max(retry_after_ms // 1000, 1))
+
+        self.respond(status, 'application/json', json.dumps(payload).encode(), headers)
+
+    def json(self, payload, status=200):
+        return status, 'application/json', json.dumps(payload).encode()
+
+    def versions(self):
+        return self.json({'versions': ['r0.0.1', 'r0.1.0', 'r0.2.0', 'r0.3.0']})
+
+    def login(self):
+        request = json.loads(self.body or b'{}')
+        user = request.get('user') or request.get('identifier', {}).get('user', 'bench')
+        hs = self.server.hs
+
+        return self.json({
+            'user_id': hs.login(user),
+            'access_token': 'token',
+            'home_server': hs.domain,
+            'device_id': 'MOCKDEVICE',
+        })
+
+    def empty(self):
+        return self.json({})
+
+    def create_filter(self):
+        hs = self.server.hs
+
+        with hs.cond:
+            filter_id = str(len(hs.filters))
+            hs.filters[filter_id] = json.loads(self.body or b'{}')
+
+        return self.json({'filter_id': filter_id})
+
+    def timeline_limit(self):
+        hs = self.server.hs
+        spec = self.query.get('filter', '')
+
+        try:
+            definition = hs.filters.get(spec) or json.loads(spec)
+            return definition['room']['timeline']['limit']
+        except (ValueError, KeyError, TypeError):
+            return None
+
+    def sync(self):
+        hs = self.server.hs
+        since = self.query.get('since')
+        since = int(since[1:]) if since else None
+        timeout = int(self.query.get('timeout', 30000))
+
+        if since is None and hs.user_id is None:
+            hs.login('bench')
+
+        return self.json(hs.sync(since, timeout, self.timeline_limit()))
+
+    def messages(self, room_id):
+        start = self.query.get('from', '')
+        start = int(start.rsplit('|', 1)[1]) if '|' in start else 0
+        limit = int(self.query.get('limit', 20))
+
+        return self.json(self.server.hs.messages(room_id, start, limit))
+
+    def members(self, room_id):
+        hs = self.server.hs
+        chunk = [{'event_id': '$member-%s-%s' % (room_id, user), 'type': 'm.room.member',
+                  'state_key': user, 'sender': user, 'room_id': room_id,
+                  'origin_server_ts': 0,
+                  'content': {'membership': 'join', 'displayname': user.split(':')[0][1:],
+                              'avatar_url': 'mxc://%s/avatar-%s' % (hs.domain,
+                                                                   user.split(':')[0][1:])}}
+                 for user in hs.rooms[room_id]['members']]
+
+        return self.json({'chunk': chunk})
+
+    def send(self, room_id, event_type, txn_id):
+        content = json.loads(self.body or b'{}')
+
+        return self.json({'event_id': self.server.hs.send(room_id, event_type, txn_id, content)})
+
+    def profile(self, user_id):
+        name = user_id.split(':')[0][1:]
+
+        return self.json({'displayname': name,
+                          'avatar_url': 'mxc://%s/avatar-%s' % (self.server.hs.domain, name)})
+
+    def joined_groups(self):
+        return self.json({'groups': []})
+
+    def notifications(self):
+        return self.json({'notifications': [], 'next_token': ''})
+
+    def upload(self):
+        hs = self.server.hs
+
+        with hs.cond:
+            media_id = 'upload%d' % len(hs.media)
+            hs.media[media_id] = (self.headers.get('Content-Type',
+                                                   'application/octet-stream'), self.body)
+
+        return self.json({'content_uri': 'mxc://%s/%s' % (hs.domain, media_id)})
+
+    def thumbnail(self, media_id):
+        hs = self.server.hs
+
+        if media_id in hs.media:
+            return (200,) + hs.media[media_id]
+
+        width = min(int(self.query.get('width', 96)), 1024)
+        height = min(int(self.query.get('height', 96)), 1024)
+
+        return 200, 'image/png', png(width, height, media_id)
+
+    def download(self, media_id):
+        hs = self.server.hs
+
+        if media_id in hs.media:
+            return self.ranged(*hs.media[media_id])
+
+        return self.ranged('application/octet-stream', hs.generate_media(media_id))
+
+    def ranged(self, content_type, body):
+        '''
+        Serve the part of the body requested with a single range (e.g bytes=100- or
+        bytes=0-99), so interrupted downloads can be resumed.
+        '''
+        total = len(body)
+        headers = {'Accept-Ranges': 'bytes'}
+
+        match = re.match(r'bytes=(\d*)-(\d*)$', self.headers.get('Range', '').strip())
+
+        if not match or match.groups() == ('', ''):
+            return 200, content_type, body, headers
+
+        first, last = match.groups()
+
+        if first:
+            start = int(first)
+            end = min(int(last), total - 1) if last else total - 1
+        else:
+            # The last N bytes.
+            start = max(total - int(last), 0)
+            end = total - 1
+
+        if start >= total or start > end:
+            headers['Content-Range'] = 'bytes */%d' % total
+            return 416, content_type, b'', headers
+
+        headers['Content-Range'] = 'bytes %d-%d/%d' % (start, end, total)
+
+        return 206, content_type, body[start:end + 1], headers
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(description='Local stand-in homeserver.')
+
+    parser.add_argument('--host', default='localhost')
+    parser.add_argument('--port', type=int, default=8448)
+    parser.add_argument('--domain', default='localhost',
+                        help='server name used in the ids')
+    parser.add_argument('--cert', help='certificate (PEM) to serve https with')
+    parser.add_argument('--key', help='private key (PEM) of the certificate')
+    parser.add_argument('--seed', type=int, default=0,
+                        help='seed of the generated data & the injected failures')
+    parser.add_argument('--verbose', action='store_true', help='log every request')
+
+    payload = parser.add_argument_group('payload scaling')
+    payload.add_argument('--rooms', type=int, default=20, help='number of joined rooms')
+    payload.add_argument('--members', type=int, default=10, help='members per room')
+    payload.add_argument('--timeline', type=int, default=20,
+                         help='events per room in the initial sync')
+    payload.add_argument('--history', type=int, default=200,
+                         help='events per room served through /messages')
+    payload.add_argument('--message-size', type=int, default=80,
+                         help='length of the message bodies')
+    payload.add_argument('--media-size', type=int, default=256 * 1024,
+                         help='size of the downloaded files')
+    payload.add_argument('--event-rate', type=float, default=0,
+                         help='new events per second from the other members')
+    payload.add_argument('--sync-file',
+                         help='recorded /sync response to serve as the initial sync')
+
+    network = parser.add_argument_group('network conditions')
+    network.add_argument('--latency', type=float, default=0, help='delay of a response in ms')
+    network.add_argument('--jitter', type=float, default=0, help='random +/- delay in ms')
+    network.add_argument('--bandwidth', type=int, default=0,
+                         help='bytes per second of each response, 0 for unlimited')
+
+    errors = parser.add_argument_group('error injection')
+    errors.add_argument('--error-rate', type=float, default=0,
+                        help='probability of a request failing')
+    errors.add_argument('--error-status', type=int, nargs='+', default=[500, 502, 503, 429],
+                        help='statuses of the failed requests')
+    errors.add_argument('--error-endpoints', default='.*',
+                        help='regex of the handler names that may fail, e.g "sync|send"')
+    errors.add_argument('--retry-after', type=int, default=2000,
+                        help='retry_after_ms of the rate limited requests')
+
+    return parser.parse_args()
+
+
+if __name__ == '__main__':
+    args = parse_args()
+
+    server = ThreadingHTTPServer((args.host, args.port), Handler)
+    server.daemon_threads = True
+    server.hs = Homeserver(args)
+
+    scheme = 'http'
+
+    if args.cert:
+        context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+        context.load_cert_chain(args.cert, args.key)
+        server.socket = context.wrap_socket(server.socket, server_side=True)
+        scheme = 'https'
+
+    threading.Thread(target=server.hs.tick, daemon=True).start()
+
+    print('Serving on %s://%s:%d' % (scheme, args.host, args.port), file=sys.stderr)
+
+    # Print the summary when the server is stopped by a benchmark script as well.
+    signal.signal(signal.SIGTERM, signal.default_int_handler)
+
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+    server.hs.summary()
@@ -15,18 +15,21 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <QBuffer>
+#include <QGuiApplication>
 #include <QtConcurrent>
+#include <cmath>
 
 #include "AvatarProvider.h"
 #include "Cache.h"
+#include "ImageCache.h"
 #include "MatrixClient.h"
 
 void
 AvatarProvider::resolve(const QString &room_id,
                         const QString &user_id,
                         QObject *receiver,
-                        std::function<void(QImage)> callback)
+                        std::function<void(QImage)> callback,
+                        AvatarTier tier)
 {
         const auto key       = QString("%1 %2").arg(room_id).arg(user_id);
         const auto avatarUrl = Cache::avatarUrl(room_id, user_id);
@@ -37,13 +40,25 @@ AvatarProvider::resolve(const QString &room_id,
         if (avatarUrl.isEmpty())
                 return;
 
-        auto data = cache::client()->image(avatarUrl);
+        const auto mediaKey = AvatarProvider::cacheKey(avatarUrl, tier);
+        const auto cacheKey = imagecache::key(avatarUrl, AvatarProvider::resolution(tier));
+
+        auto img = imagecache::find(cacheKey);
+        if (!img.isNull()) {
+                callback(img);
+                return;
+        }
+
+        auto data = cache::client()->image(mediaKey);
         if (!data.isNull()) {
-                callback(QImage::fromData(data));
+                img = QImage::fromData(data);
+                imagecache::insert(cacheKey, img);
+
+                callback(img);
                 return;
         }
 
-        auto proxy = http::client()->fetchUserAvatar(avatarUrl);
+        auto proxy = http::client()->fetchUserAvatar(avatarUrl, tier);
 
         if (proxy.isNull())
                 return;
@@ -51,16 +66,47 @@ AvatarProvider::resolve(const QString &room_id,
         connect(proxy.data(),
                 &DownloadMediaProxy::avatarDownloaded,
                 receiver,
-                [user_id, proxy, callback, avatarUrl](const QImage &img) {
+                [user_id, proxy, callback, mediaKey, cacheKey](const QImage &img,
+                                                                const QByteArray &data) {
                         proxy->deleteLater();
-                        QtConcurrent::run([img, avatarUrl]() {
-                                QByteArray data;
-                                QBuffer buffer(&data);
-                                buffer.open(QIODevice::WriteOnly);
-                                img.save(&buffer, "PNG");
-
-                                cache::client()->saveImage(avatarUrl, data);
-                        });
+                        imagecache::insert(cacheKey, img);
+
+                        // The response is stored as is; it's already in a compressed format.
+                        QtConcurrent::run(
+                          [data, mediaKey]() { cache::client()->saveImage(mediaKey, data); });
+
                         callback(img);
                 });
 }
+
+QSize
+AvatarProvider::resolution(AvatarTier tier)
+{
+        // Largest size the avatars of each tier are displayed at.
+        int size = 0;
+
+        switch (tier) {
+        case AvatarTier::Small:
+                size = 32;
+                break;
+        case AvatarTier::Timeline:
+                size = 36;
+                break;
+        case AvatarTier::List:
+                size = 44;
+                break;
+        case AvatarTier::Profile:
+                size = 48;
+                break;
+        }
+
+        size = std::ceil(size * qApp->devicePixelRatio());
+
+        return QSize(size, size);
+}
+
+QString
+AvatarProvider::cacheKey(const QString &url, AvatarTier tier)
+{
+        return QString("%1 %2").arg(url).arg(resolution(tier).width());
+}
@@ -15,6 +15,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <limits>
 #include <stdexcept>
 
@@ -23,10 +24,12 @@
 #include <QFile>
 #include <QHash>
 #include <QStandardPaths>
+#include <QtConcurrent>
 
 #include <variant.hpp>
 
 #include "Cache.h"
+#include "SyncSnapshot.h"
 #include "Utils.h"
 
 //! Should be changed when a breaking change occurs in the cache format.
@@ -35,6 +38,8 @@ static const std::string CURRENT_CACHE_FORMAT_VERSION("2018.05.11");
 
 static const lmdb::val NEXT_BATCH_KEY("next_batch");
 static const lmdb::val CACHE_FORMAT_VERSION_KEY("cache_format_version");
+static const lmdb::val TRANSACTION_ID_KEY("transaction_id");
+static const lmdb::val NOTIFICATIONS_TS_KEY("notifications_ts");
 
 //! Cache databases and their format.
 //!
@@ -45,17 +50,35 @@ static constexpr const char *INVITES_DB = "invites";
 //! Keeps already downloaded media for reuse.
 //! Format: matrix_url -> binary data.
 static constexpr const char *MEDIA_DB = "media";
+//! Media uploaded by the user, so identical content isn't uploaded twice.
+//! Format: sha256 of the content -> UploadedMedia.
+static constexpr const char *UPLOADS_DB = "uploads";
+//! Messages of the user that haven't been confirmed by the server.
+//! Format: zero padded transaction id -> OutboxMessage.
+static constexpr const char *OUTBOX_DB = "outbox";
 //! Information that  must be kept between sync requests.
 static constexpr const char *SYNC_STATE_DB = "sync_state";
 //! Read receipts per room/event.
 static constexpr const char *READ_RECEIPTS_DB = "read_receipts";
+//! Notifications that have already been shown.
+//! Format: event_id -> timestamp of the notification.
 static constexpr const char *NOTIFICATIONS_DB = "sent_notifications";
+//! How long (in ms) before the newest notification the shown ones are remembered.
+//! Anything older is considered shown.
+static constexpr uint64_t NOTIFICATIONS_RETENTION = 7 * 24 * 60 * 60 * 1000ULL;
 
 using CachedReceipts = std::multimap<uint64_t, std::string, std::greater<uint64_t>>;
 using Receipts       = std::map<std::string, std::map<std::string, uint64_t>>;
 
 namespace {
 std::unique_ptr<Cache> instance_ = nullptr;
+
+//! Zero padded, so the keys are sorted in the order of the transaction ids.
+std::string
+outboxKey(int txn_id)
+{
+        return QString("%1").arg(txn_id, 10, 10, QChar('0')).toStdString();
+}
 }
 
 namespace cache {
@@ -80,6 +103,8 @@ Cache::Cache(const QString &userId, QObject *parent)
   , roomsDb_{0}
   , invitesDb_{0}
   , mediaDb_{0}
+  , uploadsDb_{0}
+  , outboxDb_{0}
   , readReceiptsDb_{0}
   , notificationsDb_{0}
   , localUserId_{userId}
@@ -139,6 +164,8 @@ Cache::setup()
         roomsDb_         = lmdb::dbi::open(txn, ROOMS_DB, MDB_CREATE);
         invitesDb_       = lmdb::dbi::open(txn, INVITES_DB, MDB_CREATE);
         mediaDb_         = lmdb::dbi::open(txn, MEDIA_DB, MDB_CREATE);
+        uploadsDb_       = lmdb::dbi::open(txn, UPLOADS_DB, MDB_CREATE);
+        outboxDb_        = lmdb::dbi::open(txn, OUTBOX_DB, MDB_CREATE);
         readReceiptsDb_  = lmdb::dbi::open(txn, READ_RECEIPTS_DB, MDB_CREATE);
         notificationsDb_ = lmdb::dbi::open(txn, NOTIFICATIONS_DB, MDB_CREATE);
         txn.commit();
@@ -214,6 +241,49 @@ Cache::image(const QString &url) const
         return QByteArray();
 }
 
+UploadedMedia
+Cache::uploadedMedia(const QByteArray &hash) const
+{
+        if (hash.isEmpty())
+                return UploadedMedia{};
+
+        try {
+                auto txn = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
+
+                lmdb::val data;
+                bool res =
+                  lmdb::dbi_get(txn, uploadsDb_, lmdb::val(hash.data(), hash.size()), data);
+
+                txn.commit();
+
+                if (res)
+                        return json::parse(std::string(data.data(), data.size()));
+        } catch (const lmdb::error &e) {
+                qCritical() << "uploadedMedia:" << e.what();
+        } catch (const json::exception &e) {
+                qWarning() << "uploadedMedia:" << e.what();
+        }
+
+        return UploadedMedia{};
+}
+
+void
+Cache::saveUploadedMedia(const QByteArray &hash, const UploadedMedia &media)
+{
+        try {
+                auto txn = lmdb::txn::begin(env_);
+
+                lmdb::dbi_put(txn,
+                              uploadsDb_,
+                              lmdb::val(hash.data(), hash.size()),
+                              lmdb::val(json(media).dump()));
+
+                txn.commit();
+        } catch (const lmdb::error &e) {
+                qCritical() << "saveUploadedMedia:" << e.what();
+        }
+}
+
 void
 Cache::removeInvite(lmdb::txn &txn, const std::string &room_id)
 {
@@ -284,6 +354,116 @@ Cache::nextBatchToken() const
         return QString::fromUtf8(token.data(), token.size());
 }
 
+int
+Cache::transactionId() const
+{
+        try {
+                auto txn = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
+                lmdb::val value;
+
+                bool res = lmdb::dbi_get(txn, syncStateDb_, TRANSACTION_ID_KEY, value);
+
+                txn.commit();
+
+                if (res)
+                        return QByteArray(value.data(), value.size()).toInt();
+        } catch (const lmdb::error &e) {
+                qCritical() << "transactionId:" << e.what();
+        }
+
+        return 0;
+}
+
+void
+Cache::saveTransactionId(int txn_id)
+{
+        const auto value = QByteArray::number(txn_id);
+
+        try {
+                auto txn = lmdb::txn::begin(env_);
+
+                lmdb::dbi_put(
+                  txn, syncStateDb_, TRANSACTION_ID_KEY, lmdb::val(value.data(), value.size()));
+
+                txn.commit();
+        } catch (const lmdb::error &e) {
+                qCritical() << "saveTransactionId:" << e.what();
+        }
+}
+
+std::vector<OutboxMessage>
+Cache::outbox() const
+{
+        std::vector<OutboxMessage> messages;
+
+        try {
+                auto txn    = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
+                auto cursor = lmdb::cursor::open(txn, outboxDb_);
+
+                std::string key, value;
+
+                while (cursor.get(key, value, MDB_NEXT)) {
+                        try {
+                                messages.push_back(json::parse(value));
+                        } catch (const json::exception &e) {
+                                qWarning() << "outbox:" << e.what();
+                        }
+                }
+
+                cursor.close();
+                txn.commit();
+        } catch (const lmdb::error &e) {
+                qCritical() << "outbox:" << e.what();
+        }
+
+        return messages;
+}
+
+void
+Cache::saveOutboxMessage(const OutboxMessage &msg)
+{
+        try {
+                auto txn = lmdb::txn::begin(env_);
+
+                lmdb::dbi_put(
+                  txn, outboxDb_, lmdb::val(outboxKey(msg.txn_id)), lmdb::val(json(msg).dump()));
+
+                // The message & the counter are written together, so the id of a saved
+                // message can't be handed out again after a restart.
+                lmdb::val value;
+                int saved = 0;
+
+                if (lmdb::dbi_get(txn, syncStateDb_, TRANSACTION_ID_KEY, value))
+                        saved = QByteArray(value.data(), value.size()).toInt();
+
+                if (msg.txn_id > saved) {
+                        const auto txn_id = QByteArray::number(msg.txn_id);
+                        lmdb::dbi_put(txn,
+                                      syncStateDb_,
+                                      TRANSACTION_ID_KEY,
+                                      lmdb::val(txn_id.data(), txn_id.size()));
+                }
+
+                txn.commit();
+        } catch (const lmdb::error &e) {
+                qCritical() << "saveOutboxMessage:" << e.what();
+        }
+}
+
+void
+Cache::removeOutboxMessage(int txn_id)
+{
+        try {
+                auto txn = lmdb::txn::begin(env_);
+
+                lmdb::dbi_del(txn, outboxDb_, lmdb::val(outboxKey(txn_id)), nullptr);
+
+                txn.commit();
+        } catch (const lmdb::error &e) {
+                qCritical() << "removeOutboxMessage:" << e.what();
+        }
+}
+
 void
 Cache::deleteData()
 {
@@ -418,32 +598,57 @@ Cache::updateReadReceipt(lmdb::txn &txn, const std::string &room_id, const Recei
 void
 Cache::saveState(const mtx::responses::Sync &res)
 {
+        snapshot::checkShared(res.rooms, "saveState");
+
+        struct PreparedRoom
+        {
+                const std::string *room_id;
+                const mtx::responses::JoinedRoom *room;
+                StateUpdates updates;
+        };
+
+        std::vector<PreparedRoom> joined;
+        joined.reserve(res.rooms.join.size());
+
+        for (const auto &room : res.rooms.join)
+                joined.push_back(PreparedRoom{&room.first, &room.second, {}});
+
+        // Serialize the state of every room concurrently, so that the write
+        // transaction below only has to store the results.
+        QtConcurrent::blockingMap(joined, [this](PreparedRoom &prepared) {
+                prepareStateEvents(prepared.updates, prepared.room->state.events);
+                prepareStateEvents(prepared.updates, prepared.room->timeline.events);
+        });
+
         auto txn = lmdb::txn::begin(env_);
 
         setNextBatchToken(txn, res.next_batch);
 
         // Save joined rooms
-        for (const auto &room : res.rooms.join) {
-                auto statesdb  = getStatesDb(txn, room.first);
-                auto membersdb = getMembersDb(txn, room.first);
+        for (const auto &prepared : joined) {
+                const auto &room_id = *prepared.room_id;
+
+                auto statesdb  = getStatesDb(txn, room_id);
+                auto membersdb = getMembersDb(txn, room_id);
 
-                saveStateEvents(txn, statesdb, membersdb, room.first, room.second.state.events);
-                saveStateEvents(txn, statesdb, membersdb, room.first, room.second.timeline.events);
+                applyStateUpdates(txn, statesdb, membersdb, room_id, prepared.updates);
 
+                // The room info depends on the state that was stored previously,
+                // so it's calculated from the (uncommitted) transaction.
                 RoomInfo updatedInfo;
                 updatedInfo.name  = getRoomName(txn, statesdb, membersdb).toStdString();
                 updatedInfo.topic = getRoomTopic(txn, statesdb).toStdString();
                 updatedInfo.avatar_url =
-                  getRoomAvatarUrl(txn, statesdb, membersdb, QString::fromStdString(room.first))
+                  getRoomAvatarUrl(txn, statesdb, membersdb, QString::fromStdString(room_id))
                     .toStdString();
 
                 lmdb::dbi_put(
-                  txn, roomsDb_, lmdb::val(room.first), lmdb::val(json(updatedInfo).dump()));
+                  txn, roomsDb_, lmdb::val(room_id), lmdb::val(json(updatedInfo).dump()));
 
-                updateReadReceipt(txn, room.first, room.second.ephemeral.receipts);
+                updateReadReceipt(txn, room_id, prepared.room->ephemeral.receipts);
 
                 // Clean up non-valid invites.
-                removeInvite(txn, room.first);
+                removeInvite(txn, room_id);
         }
 
         saveInvites(txn, res.rooms.invite);
@@ -453,6 +658,74 @@ Cache::saveState(const mtx::responses::Sync &res)
         txn.commit();
 }
 
+void
+Cache::saveMembers(
+  const std::string &room_id,
+  const std::vector<mtx::events::StateEvent<mtx::events::state::Member>> &members)
+{
+        StateUpdates updates;
+        for (const auto &member : members)
+                prepareMemberEvent(updates, member);
+
+        auto txn       = lmdb::txn::begin(env_);
+        auto statesdb  = getStatesDb(txn, room_id);
+        auto membersdb = getMembersDb(txn, room_id);
+
+        applyStateUpdates(txn, statesdb, membersdb, room_id, updates);
+
+        // The calculated name & avatar of the room might depend on the members.
+        lmdb::val data;
+        if (lmdb::dbi_get(txn, roomsDb_, lmdb::val(room_id), data)) {
+                try {
+                        RoomInfo info = json::parse(std::string(data.data(), data.size()));
+                        info.name     = getRoomName(txn, statesdb, membersdb).toStdString();
+                        info.avatar_url =
+                          getRoomAvatarUrl(
+                            txn, statesdb, membersdb, QString::fromStdString(room_id))
+                            .toStdString();
+
+                        lmdb::dbi_put(
+                          txn, roomsDb_, lmdb::val(room_id), lmdb::val(json(info).dump()));
+                } catch (const json::exception &e) {
+                        qWarning() << "failed to parse room info:"
+                                   << QString::fromStdString(room_id) << e.what();
+                }
+        }
+
+        txn.commit();
+}
+
+void
+Cache::applyStateUpdates(lmdb::txn &txn,
+                         const lmdb::dbi &statesdb,
+                         const lmdb::dbi &membersdb,
+                         const std::string &room_id,
+                         const StateUpdates &updates)
+{
+        for (const auto &event : updates.state)
+                lmdb::dbi_put(txn, statesdb, lmdb::val(event.first), lmdb::val(event.second));
+
+        const auto room = QString::fromStdString(room_id);
+
+        for (const auto &member : updates.members) {
+                const auto user_id = QString::fromStdString(member.user_id);
+
+                if (member.removed) {
+                        lmdb::dbi_del(txn, membersdb, lmdb::val(member.user_id), lmdb::val(""));
+
+                        removeDisplayName(room, user_id);
+                        removeAvatarUrl(room, user_id);
+
+                        continue;
+                }
+
+                lmdb::dbi_put(txn, membersdb, lmdb::val(member.user_id), lmdb::val(member.data));
+
+                insertDisplayName(room, user_id, QString::fromStdString(member.info.name));
+                insertAvatarUrl(room, user_id, QString::fromStdString(member.info.avatar_url));
+        }
+}
+
 void
 Cache::saveInvites(lmdb::txn &txn, const std::map<std::string, mtx::responses::InvitedRoom> &rooms)
 {
@@ -1194,34 +1467,94 @@ Cache::getMembers(const std::string &room_id, std::size_t startIndex, std::size_
         return members;
 }
 
-void
-Cache::markSentNotification(const std::string &event_id)
+std::vector<mtx::responses::Notification>
+Cache::markSentNotifications(const std::vector<mtx::responses::Notification> &notifications)
 {
-        auto txn = lmdb::txn::begin(env_);
-        lmdb::dbi_put(txn, notificationsDb_, lmdb::val(event_id), lmdb::val(std::string("")));
-        txn.commit();
-}
+        std::vector<mtx::responses::Notification> unsent;
 
-void
-Cache::removeReadNotification(const std::string &event_id)
-{
         auto txn = lmdb::txn::begin(env_);
 
-        lmdb::dbi_del(txn, notificationsDb_, lmdb::val(event_id), nullptr);
+        lmdb::val value;
+        uint64_t newest = 0;
+
+        if (lmdb::dbi_get(txn, syncStateDb_, NOTIFICATIONS_TS_KEY, value))
+                newest = QByteArray(value.data(), value.size()).toULongLong();
+
+        const auto expired = [](uint64_t ts, uint64_t newest) {
+                return newest > NOTIFICATIONS_RETENTION && ts < newest - NOTIFICATIONS_RETENTION;
+        };
+
+        const uint64_t previous = newest;
+
+        for (const auto &item : notifications) {
+                const auto event_id = utils::event_id(item.event);
+
+                newest = std::max<uint64_t>(newest, item.ts);
+
+                if (item.read) {
+                        lmdb::dbi_del(txn, notificationsDb_, lmdb::val(event_id), nullptr);
+                        continue;
+                }
+
+                // It's no longer remembered whether it was shown.
+                if (expired(item.ts, previous))
+                        continue;
+
+                // We should only send one notification per event.
+                if (lmdb::dbi_get(txn, notificationsDb_, lmdb::val(event_id), value))
+                        continue;
+
+                const auto item_ts = QByteArray::number(static_cast<qulonglong>(item.ts));
+                lmdb::dbi_put(txn,
+                              notificationsDb_,
+                              lmdb::val(event_id),
+                              lmdb::val(item_ts.data(), item_ts.size()));
+
+                unsent.push_back(item);
+        }
+
+        // Forget the notifications that fell out of the retention window.
+        std::vector<std::string> forgotten;
+
+        auto cursor = lmdb::cursor::open(txn, notificationsDb_);
+
+        std::string event_id, item_ts;
+        while (cursor.get(event_id, item_ts, MDB_NEXT)) {
+                if (expired(QByteArray::fromStdString(item_ts).toULongLong(), newest))
+                        forgotten.push_back(event_id);
+        }
+
+        cursor.close();
+
+        for (const auto &id : forgotten)
+                lmdb::dbi_del(txn, notificationsDb_, lmdb::val(id), nullptr);
+
+        const auto ts = QByteArray::number(static_cast<qulonglong>(newest));
+        lmdb::dbi_put(txn, syncStateDb_, NOTIFICATIONS_TS_KEY, lmdb::val(ts.data(), ts.size()));
 
         txn.commit();
+
+        return unsent;
 }
 
-bool
-Cache::isNotificationSent(const std::string &event_id)
+uint64_t
+Cache::newestNotificationTs() const
 {
-        auto txn = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
+        try {
+                auto txn = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
+                lmdb::val value;
 
-        lmdb::val value;
-        bool res = lmdb::dbi_get(txn, notificationsDb_, lmdb::val(event_id), value);
-        txn.commit();
+                bool res = lmdb::dbi_get(txn, syncStateDb_, NOTIFICATIONS_TS_KEY, value);
 
-        return res;
+                txn.commit();
+
+                if (res)
+                        return QByteArray(value.data(), value.size()).toULongLong();
+        } catch (const lmdb::error &e) {
+                qCritical() << "newestNotificationTs:" << e.what();
+        }
+
+        return 0;
 }
 
 bool
@@ -1285,6 +1618,12 @@ Cache::displayName(const std::string &room_id, const std::string &user_id)
         return user_id;
 }
 
+bool
+Cache::isMemberKnown(const QString &room_id, const QString &user_id)
+{
+        return DisplayNames.contains(QString("%1 %2").arg(room_id).arg(user_id));
+}
+
 QString
 Cache::avatarUrl(const QString &room_id, const QString &user_id)
 {
@@ -15,6 +15,9 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <set>
+
 #include <QApplication>
 #include <QDebug>
 #include <QSettings>
@@ -45,12 +48,61 @@
 
 constexpr int SYNC_RETRY_TIMEOUT         = 40 * 1000;
 constexpr int INITIAL_SYNC_RETRY_TIMEOUT = 240 * 1000;
+//! Backoff of the failed sync requests.
+constexpr int SYNC_RETRY_BASE_DELAY = 1000;
+constexpr int SYNC_RETRY_MAX_DELAY  = 5 * 60 * 1000;
+//! Maximum number of received sync responses that are waiting to be saved.
+constexpr int MAX_PENDING_SYNC_BATCHES = 3;
 
 ChatPage *ChatPage::instance_ = nullptr;
 
+namespace {
+//! The order in which the history of the rooms is retrieved after the initial sync:
+//! rooms with unread notifications first, then the most recently active ones.
+std::vector<std::string>
+backfillOrder(const mtx::responses::Rooms &rooms)
+{
+        struct Entry
+        {
+                std::string room_id;
+                uint16_t notifications;
+                uint64_t timestamp;
+        };
+
+        std::vector<Entry> entries;
+        entries.reserve(rooms.join.size());
+
+        for (const auto &room : rooms.join) {
+                const auto &events = room.second.timeline.events;
+
+                entries.push_back(
+                  Entry{room.first,
+                        room.second.unread_notifications.notification_count,
+                        events.empty() ? 0 : utils::event_timestamp(events.back())});
+        }
+
+        std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+                if (a.notifications != b.notifications)
+                        return a.notifications > b.notifications;
+
+                return a.timestamp > b.timestamp;
+        });
+
+        std::vector<std::string> order;
+        order.reserve(entries.size());
+
+        for (const auto &entry : entries)
+                order.push_back(entry.room_id);
+
+        return order;
+}
+}
+
 ChatPage::ChatPage(QSharedPointer<UserSettings> userSettings, QWidget *parent)
   : QWidget(parent)
   , userSettings_{userSettings}
+  , syncRetry_{SYNC_RETRY_BASE_DELAY, SYNC_RETRY_MAX_DELAY}
+  , initialSyncRetry_{SYNC_RETRY_BASE_DELAY, SYNC_RETRY_MAX_DELAY}
 {
         setObjectName("chatPage");
 
@@ -243,15 +295,29 @@ ChatPage::ChatPage(QSharedPointer<UserSettings> userSettings, QWidget *parent)
           http::client(), &MatrixClient::roomCreationFailed, this, &ChatPage::showNotification);
         connect(http::client(), &MatrixClient::joinFailed, this, &ChatPage::showNotification);
         connect(http::client(), &MatrixClient::uploadFailed, this, [this](int, const QString &msg) {
-                text_input_->hideUploadSpinner();
+                if (!http::client()->isUploading())
+                        text_input_->hideUploadSpinner();
                 emit showNotification(msg);
         });
+        connect(http::client(),
+                &MatrixClient::uploadCanceled,
+                text_input_,
+                &TextInputWidget::hideUploadSpinner);
+        connect(http::client(),
+                &MatrixClient::uploadProgress,
+                text_input_,
+                &TextInputWidget::showUploadProgress);
+        connect(text_input_,
+                &TextInputWidget::cancelUpload,
+                http::client(),
+                &MatrixClient::cancelUploads);
         connect(
           http::client(),
           &MatrixClient::imageUploaded,
           this,
           [this](QString roomid, QString filename, QString url, QString mime, uint64_t dsize) {
-                  text_input_->hideUploadSpinner();
+                  if (!http::client()->isUploading())
+                          text_input_->hideUploadSpinner();
                   view_manager_->queueImageMessage(roomid, filename, url, mime, dsize);
           });
         connect(
@@ -259,7 +325,8 @@ ChatPage::ChatPage(QSharedPointer<UserSettings> userSettings, QWidget *parent)
           &MatrixClient::fileUploaded,
           this,
           [this](QString roomid, QString filename, QString url, QString mime, uint64_t dsize) {
-                  text_input_->hideUploadSpinner();
+                  if (!http::client()->isUploading())
+                          text_input_->hideUploadSpinner();
                   view_manager_->queueFileMessage(roomid, filename, url, mime, dsize);
           });
         connect(
@@ -267,7 +334,8 @@ ChatPage::ChatPage(QSharedPointer<UserSettings> userSettings, QWidget *parent)
           &MatrixClient::audioUploaded,
           this,
           [this](QString roomid, QString filename, QString url, QString mime, uint64_t dsize) {
-                  text_input_->hideUploadSpinner();
+                  if (!http::client()->isUploading())
+                          text_input_->hideUploadSpinner();
                   view_manager_->queueAudioMessage(roomid, filename, url, mime, dsize);
           });
         connect(
@@ -275,7 +343,8 @@ ChatPage::ChatPage(QSharedPointer<UserSettings> userSettings, QWidget *parent)
           &MatrixClient::videoUploaded,
           this,
           [this](QString roomid, QString filename, QString url, QString mime, uint64_t dsize) {
-                  text_input_->hideUploadSpinner();
+                  if (!http::client()->isUploading())
+                          text_input_->hideUploadSpinner();
                   view_manager_->queueVideoMessage(roomid, filename, url, mime, dsize);
           });
 
@@ -330,6 +399,24 @@ ChatPage::ChatPage(QSharedPointer<UserSettings> userSettings, QWidget *parent)
                 }
         });
         connect(http::client(), &MatrixClient::leftRoom, this, &ChatPage::removeRoom);
+        connect(http::client(),
+                &MatrixClient::roomMembersRetrieved,
+                this,
+                [this](const QString &room_id, const RoomMembers &members) {
+                        QtConcurrent::run([this, room_id, members]() {
+                                try {
+                                        cache::client()->saveMembers(room_id.toStdString(),
+                                                                     members);
+                                        emit roomMembersLoaded(room_id);
+                                } catch (const lmdb::error &e) {
+                                        qWarning() << "failed to save members:" << e.what();
+                                }
+                        });
+                });
+        connect(http::client(),
+                &MatrixClient::roomMembersFailed,
+                this,
+                [this](const QString &room_id) { requestedMembers_.erase(room_id); });
         connect(http::client(), &MatrixClient::invitedUser, this, [this](QString, QString user) {
                 emit showNotification(QString("Invited user %1").arg(user));
         });
@@ -364,6 +451,28 @@ ChatPage::ChatPage(QSharedPointer<UserSettings> userSettings, QWidget *parent)
         initialSyncTimer_ = new QTimer(this);
         connect(initialSyncTimer_, &QTimer::timeout, this, [this]() { retryInitialSync(); });
 
+        // A single thread keeps the sync responses in order.
+        syncPool_ = new QThreadPool(this);
+        syncPool_->setMaxThreadCount(1);
+
+        connect(this, &ChatPage::syncBatchSaved, this, [this]() {
+                pendingSyncBatches_ -= 1;
+
+                if (!stalledNextBatch_.isEmpty() &&
+                    pendingSyncBatches_ < MAX_PENDING_SYNC_BATCHES) {
+                        emit continueSync(stalledNextBatch_);
+                        stalledNextBatch_.clear();
+                }
+        });
+
+        connect(this, &ChatPage::syncSaveFailed, this, [this]() {
+                stalledNextBatch_.clear();
+                resyncPending_ = false;
+
+                // Continue from the last response that made it to the cache.
+                emit continueSync(cache::client()->nextBatchToken());
+        });
+
         syncTimeoutTimer_ = new QTimer(this);
         connect(syncTimeoutTimer_, &QTimer::timeout, this, [this]() {
                 if (http::client()->getHomeServer().isEmpty()) {
@@ -371,10 +480,20 @@ ChatPage::ChatPage(QSharedPointer<UserSettings> userSettings, QWidget *parent)
                         return;
                 }
 
-                qDebug() << "Sync took too long. Retrying...";
+                qDebug() << "Retrying sync...";
+
+                // Watch over the new request, in case it takes too long as well.
+                syncTimeoutTimer_->start(SYNC_RETRY_TIMEOUT);
                 http::client()->sync();
         });
 
+        connect(http::client(), &MatrixClient::syncFailed, this, [this](int server_delay) {
+                const auto delay = syncRetry_.failed(server_delay);
+
+                qDebug() << "Sync failed. Retrying in" << delay << "ms";
+                syncTimeoutTimer_->start(delay);
+        });
+
         connect(communitiesList_,
                 &CommunitiesList::communityChanged,
                 this,
@@ -408,37 +527,17 @@ ChatPage::ChatPage(QSharedPointer<UserSettings> userSettings, QWidget *parent)
         connect(this,
                 &ChatPage::initializeViews,
                 view_manager_,
-                [this](const mtx::responses::Rooms &rooms) { view_manager_->initialize(rooms); });
+                [this](const SyncSnapshot &res) { view_manager_->initialize(res->rooms); });
         connect(
           this,
           &ChatPage::initializeEmptyViews,
           this,
           [this](const std::vector<std::string> &rooms) { view_manager_->initialize(rooms); });
-        connect(this, &ChatPage::syncUI, this, [this](const mtx::responses::Rooms &rooms) {
-                try {
-                        room_list_->cleanupInvites(cache::client()->invites());
-                } catch (const lmdb::error &e) {
-                        qWarning() << "failed to retrieve invites" << e.what();
-                }
-
-                view_manager_->initialize(rooms);
-                removeLeftRooms(rooms.leave);
-
-                bool hasNotifications = false;
-                for (const auto &room : rooms.join) {
-                        auto room_id = QString::fromStdString(room.first);
-
-                        updateTypingUsers(room_id, room.second.ephemeral.typing);
-                        updateRoomNotificationCount(
-                          room_id, room.second.unread_notifications.notification_count);
-
-                        if (room.second.unread_notifications.notification_count > 0)
-                                hasNotifications = true;
-                }
-
-                if (hasNotifications)
-                        http::client()->getNotifications();
-        });
+        connect(this, &ChatPage::syncUI, this, &ChatPage::applyPendingSyncs);
+        connect(this,
+                &ChatPage::backfillRooms,
+                view_manager_,
+                [this](const std::vector<std::string> &rooms) { view_manager_->backfill(rooms); });
         connect(this, &ChatPage::syncRoomlist, room_list_, &RoomList::sync);
         connect(
           this, &ChatPage::syncTopBar, this, [this](const std::map<QString, RoomInfo> &updates) {
@@ -450,7 +549,6 @@ ChatPage::ChatPage(QSharedPointer<UserSettings> userSettings, QWidget *parent)
 
         qRegisterMetaType<std::map<QString, RoomInfo>>();
         qRegisterMetaType<QMap<QString, RoomInfo>>();
-        qRegisterMetaType<mtx::responses::Rooms>();
         qRegisterMetaType<std::vector<std::string>>();
 }
 
@@ -467,6 +565,17 @@ ChatPage::logout()
 void
 ChatPage::resetUI()
 {
+        stalledNextBatch_.clear();
+
+        {
+                QMutexLocker lock(&pendingSyncsMutex_);
+                pendingSyncs_.clear();
+                pendingRoomUpdates_.clear();
+        }
+
+        notificationCounts_.clear();
+        requestedMembers_.clear();
+
         room_list_->clear();
         top_bar_->reset();
         user_info_widget_->reset();
@@ -489,16 +598,30 @@ ChatPage::deleteConfigs()
         settings.remove("");
         settings.endGroup();
 
+        // Let the pending sync responses finish before removing the database.
+        syncPool_->waitForDone();
+
         cache::client()->deleteData();
 
         http::client()->reset();
 }
 
+void
+ChatPage::loadRoomMembers(const QString &room_id)
+{
+        if (room_id.isEmpty() || requestedMembers_.count(room_id) != 0)
+                return;
+
+        requestedMembers_.insert(room_id);
+        http::client()->getRoomMembers(room_id);
+}
+
 void
 ChatPage::bootstrap(QString userid, QString homeserver, QString token)
 {
         http::client()->setServer(homeserver);
         http::client()->setAccessToken(token);
+        http::client()->prewarmConnections();
         http::client()->getOwnProfile();
         http::client()->getOwnCommunities();
 
@@ -513,6 +636,8 @@ ChatPage::bootstrap(QString userid, QString homeserver, QString token)
                         cache::client()->setCurrentFormat();
                 }
 
+                http::client()->restoreTransactionId(cache::client()->transactionId());
+
                 if (cache::client()->isInitialized()) {
                         loadStateFromCache();
                         return;
@@ -529,41 +654,166 @@ ChatPage::bootstrap(QString userid, QString homeserver, QString token)
 }
 
 void
-ChatPage::syncCompleted(const mtx::responses::Sync &response)
+ChatPage::syncCompleted(const SyncSnapshot &response)
 {
+        // The state before this response is missing from the cache.
+        if (resyncPending_)
+                return;
+
         syncTimeoutTimer_->stop();
+        syncRetry_.succeeded();
+
+        // Start the next long-poll right away. The response is saved &
+        // applied to the UI in the background, in the order it was received.
+        const auto next_batch = QString::fromStdString(response->next_batch);
+
+        pendingSyncBatches_ += 1;
+
+        if (pendingSyncBatches_ < MAX_PENDING_SYNC_BATCHES)
+                emit continueSync(next_batch);
+        else
+                stalledNextBatch_ = next_batch;
+
+        const int generation = syncGeneration_;
+
+        QtConcurrent::run(syncPool_, [this, response, generation]() {
+                // A previous response failed to be saved. Saving this one would
+                // skip over the missing state & timeline.
+                if (generation != syncGeneration_) {
+                        emit syncBatchSaved();
+                        return;
+                }
 
-        QtConcurrent::run([this, res = std::move(response)]() {
                 try {
-                        cache::client()->saveState(res);
-                        emit syncUI(res.rooms);
+                        cache::client()->saveState(*response);
+
+                        auto updates = cache::client()->roomUpdates(*response);
+
+                        bool wasEmpty = false;
 
-                        auto updates = cache::client()->roomUpdates(res);
+                        {
+                                QMutexLocker lock(&pendingSyncsMutex_);
 
-                        emit syncTopBar(updates);
-                        emit syncRoomlist(updates);
+                                wasEmpty = pendingSyncs_.empty();
+                                pendingSyncs_.push_back(response);
 
+                                for (auto &update : updates)
+                                        pendingRoomUpdates_[update.first] = std::move(update.second);
+
+                                // Don't bring back a room that was left in this response.
+                                for (const auto &room : response->rooms.leave)
+                                        pendingRoomUpdates_.erase(
+                                          QString::fromStdString(room.first));
+                        }
+
+                        // If the UI hasn't consumed the previous responses yet, this one
+                        // will be applied along with them.
+                        if (wasEmpty)
+                                emit syncUI();
                 } catch (const lmdb::error &e) {
-                        std::cout << "save cache error:" << e.what() << '\n';
-                        // TODO: retry sync.
-                        return;
+                        qCritical() << "saveState:" << e.what();
+
+                        syncGeneration_ += 1;
+                        resyncPending_ = true;
+
+                        emit syncSaveFailed();
                 }
 
-                emit continueSync(cache::client()->nextBatchToken());
+                emit syncBatchSaved();
         });
 }
 
 void
-ChatPage::initialSyncCompleted(const mtx::responses::Sync &response)
+ChatPage::applyPendingSyncs()
+{
+        std::vector<SyncSnapshot> syncs;
+        std::map<QString, RoomInfo> updates;
+
+        {
+                QMutexLocker lock(&pendingSyncsMutex_);
+
+                std::swap(syncs, pendingSyncs_);
+                std::swap(updates, pendingRoomUpdates_);
+        }
+
+        if (syncs.empty())
+                return;
+
+        try {
+                room_list_->cleanupInvites(cache::client()->invites());
+        } catch (const lmdb::error &e) {
+                qWarning() << "failed to retrieve invites" << e.what();
+        }
+
+        // The timelines of each room, in the order the responses were received.
+        std::map<QString, std::vector<const mtx::responses::JoinedRoom *>> timelines;
+        // Only the most recent typing users & notification count of each room is relevant.
+        std::map<QString, const mtx::responses::JoinedRoom *> latest;
+        // The rooms that were left and not joined again afterwards.
+        std::set<QString> left;
+
+        for (const auto &res : syncs) {
+                removeLeftRooms(res->rooms.leave);
+
+                for (const auto &room : res->rooms.join) {
+                        const auto room_id = QString::fromStdString(room.first);
+
+                        timelines[room_id].push_back(&room.second);
+                        latest[room_id] = &room.second;
+                        left.erase(room_id);
+                }
+
+                // Anything received before leaving the room is gone along with it.
+                for (const auto &room : res->rooms.leave) {
+                        const auto room_id = QString::fromStdString(room.first);
+
+                        timelines.erase(room_id);
+                        latest.erase(room_id);
+                        left.insert(room_id);
+                }
+        }
+
+        for (const auto &room_id : left)
+                updates.erase(room_id);
+
+        view_manager_->sync(timelines);
+
+        bool hasNotifications = false;
+        for (const auto &room : latest) {
+                const auto count = room.second->unread_notifications.notification_count;
+
+                updateTypingUsers(room.first, room.second->ephemeral.typing);
+                updateRoomNotificationCount(room.first, count);
+
+                // The notifications only need to be retrieved when new ones arrive.
+                auto &previous = notificationCounts_[room.first];
+                if (count > previous)
+                        hasNotifications = true;
+
+                previous = count;
+        }
+
+        if (hasNotifications)
+                http::client()->getNotifications();
+
+        if (!updates.empty()) {
+                emit syncTopBar(updates);
+                emit syncRoomlist(updates);
+        }
+}
+
+void
+ChatPage::initialSyncCompleted(const SyncSnapshot &response)
 {
         initialSyncTimer_->stop();
+        initialSyncRetry_.succeeded();
 
         qDebug() << "initial sync completed";
 
-        QtConcurrent::run([this, res = std::move(response)]() {
+        QtConcurrent::run([this, response]() {
                 try {
-                        cache::client()->saveState(res);
-                        emit initializeViews(std::move(res.rooms));
+                        cache::client()->saveState(*response);
+                        emit initializeViews(response);
                         emit initializeRoomList(cache::client()->roomInfo());
                 } catch (const lmdb::error &e) {
                         qWarning() << "cache error:" << QString::fromStdString(e.what());
@@ -573,6 +823,9 @@ ChatPage::initialSyncCompleted(const mtx::responses::Sync &response)
 
                 emit continueSync(cache::client()->nextBatchToken());
                 emit contentLoaded();
+
+                // The rooms are usable at this point. Their history is filled in afterwards.
+                emit backfillRooms(backfillOrder(response->rooms));
         });
 }
 
@@ -597,15 +850,17 @@ ChatPage::updateOwnProfileInfo(const QUrl &avatar_url, const QString &display_na
         if (!avatar_url.isValid())
                 return;
 
+        const auto key = AvatarProvider::cacheKey(avatar_url.toString(), AvatarTier::Profile);
+
         if (cache::client()) {
-                auto data = cache::client()->image(avatar_url.toString());
+                auto data = cache::client()->image(key);
                 if (!data.isNull()) {
                         user_info_widget_->setAvatar(QImage::fromData(data));
                         return;
                 }
         }
 
-        auto proxy = http::client()->fetchUserAvatar(avatar_url);
+        auto proxy = http::client()->fetchUserAvatar(avatar_url, AvatarTier::Profile);
 
         if (proxy.isNull())
                 return;
@@ -614,9 +869,12 @@ ChatPage::updateOwnProfileInfo(const QUrl &avatar_url, const QString &display_na
         connect(proxy.data(),
                 &DownloadMediaProxy::avatarDownloaded,
                 this,
-                [this, proxy](const QImage &img) {
+                [this, proxy, key](const QImage &img, const QByteArray &data) {
                         proxy->deleteLater();
                         user_info_widget_->setAvatar(img);
+
+                        if (cache::client())
+                                cache::client()->saveImage(key, data);
                 });
 }
 
@@ -824,7 +1082,7 @@ ChatPage::setGroupViewState(bool isEnabled)
 }
 
 void
-ChatPage::retryInitialSync(int status_code)
+ChatPage::retryInitialSync(int status_code, int server_delay)
 {
         initialSyncTimer_->stop();
 
@@ -835,12 +1093,22 @@ ChatPage::retryInitialSync(int status_code)
                 return;
         }
 
-        // Retry on Bad-Gateway & Gateway-Timeout errors
-        if (status_code == -1 || status_code == 504 || status_code == 502 || status_code == 524) {
-                qWarning() << "retrying initial sync";
+        // Retry on network, rate-limiting, Bad-Gateway, Service-Unavailable
+        // & Gateway-Timeout errors.
+        if (status_code == -1 || status_code == 0 || status_code == 429 || status_code == 502 ||
+            status_code == 503 || status_code == 504 || status_code == 524) {
+                const auto delay = initialSyncRetry_.failed(server_delay);
+
+                qWarning() << "retrying initial sync in" << delay << "ms";
+
+                QTimer::singleShot(delay, this, [this]() {
+                        // The user logged out in the meantime.
+                        if (http::client()->getHomeServer().isEmpty())
+                                return;
 
-                http::client()->initialSync();
-                initialSyncTimer_->start(INITIAL_SYNC_RETRY_TIMEOUT);
+                        http::client()->initialSync();
+                        initialSyncTimer_->start(INITIAL_SYNC_RETRY_TIMEOUT);
+                });
         } else {
                 // Drop into the login screen.
                 deleteConfigs();
@@ -859,34 +1127,33 @@ ChatPage::updateRoomNotificationCount(const QString &room_id, uint16_t notificat
 void
 ChatPage::sendDesktopNotifications(const mtx::responses::Notifications &res)
 {
-        for (const auto &item : res.notifications) {
-                const auto event_id = utils::event_id(item.event);
+        std::vector<mtx::responses::Notification> unsent;
+        std::map<QString, RoomInfo> rooms;
 
-                try {
-                        if (item.read) {
-                                cache::client()->removeReadNotification(event_id);
-                                continue;
-                        }
+        try {
+                unsent = cache::client()->markSentNotifications(res.notifications);
 
-                        if (!cache::client()->isNotificationSent(event_id)) {
-                                const auto room_id = QString::fromStdString(item.room_id);
-                                const auto user_id = utils::event_sender(item.event);
+                std::vector<std::string> room_ids;
+                for (const auto &item : unsent)
+                        room_ids.push_back(item.room_id);
 
-                                // We should only sent one notification per event.
-                                cache::client()->markSentNotification(event_id);
+                rooms = cache::client()->getRoomInfo(room_ids);
+        } catch (const lmdb::error &e) {
+                qWarning() << e.what();
+                return;
+        }
 
-                                // Don't send a notification when the current room is opened.
-                                if (isRoomActive(room_id))
-                                        continue;
+        for (const auto &item : unsent) {
+                const auto room_id = QString::fromStdString(item.room_id);
+                const auto user_id = utils::event_sender(item.event);
 
-                                NotificationsManager::postNotification(
-                                  QString::fromStdString(
-                                    cache::client()->singleRoomInfo(item.room_id).name),
-                                  Cache::displayName(room_id, user_id),
-                                  utils::event_body(item.event));
-                        }
-                } catch (const lmdb::error &e) {
-                        qWarning() << e.what();
-                }
+                // Don't send a notification when the current room is opened.
+                if (isRoomActive(room_id))
+                        continue;
+
+                NotificationsManager::postNotification(
+                  QString::fromStdString(rooms[room_id].name),
+                  Cache::displayName(room_id, user_id),
+                  utils::event_body(item.event));
         }
 }
@@ -43,7 +43,7 @@ CommunitiesList::CommunitiesList(QWidget *parent)
                 this,
                 [](QString communityId, QJsonObject profile) {
                         http::client()->fetchCommunityAvatar(
-                          communityId, QUrl(profile["avatar_url"].toString()));
+                          communityId, QUrl(profile["avatar_url"].toString()), AvatarTier::List);
                 });
         connect(http::client(),
                 SIGNAL(communityAvatarRetrieved(const QString &, const QPixmap &)),
@@ -77,7 +77,8 @@ CommunitiesList::addCommunity(QSharedPointer<Community> community, const QString
 
         communities_.emplace(community_id, QSharedPointer<CommunitiesListItem>(list_item));
 
-        http::client()->fetchCommunityAvatar(community_id, community->getAvatar());
+        http::client()->fetchCommunityAvatar(
+          community_id, community->getAvatar(), AvatarTier::List);
 
         contentsLayout_->insertWidget(contentsLayout_->count() - 1, list_item);
 
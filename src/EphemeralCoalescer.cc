@@ -0,0 +1,148 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <QDateTime>
+#include <QSettings>
+
+#include "Cache.h"
+#include "EphemeralCoalescer.h"
+
+//! How long the requests are held back, so they can be coalesced.
+constexpr int FLUSH_DELAY = 500;
+
+EphemeralCoalescer::EphemeralCoalescer(ReceiptSender sendReceipt,
+                                       TypingSender sendTyping,
+                                       QObject *parent)
+  : QObject(parent)
+  , sendReceipt_{std::move(sendReceipt)}
+  , sendTyping_{std::move(sendTyping)}
+{
+        flushTimer_.setSingleShot(true);
+        flushTimer_.setInterval(FLUSH_DELAY);
+
+        connect(&flushTimer_, &QTimer::timeout, this, &EphemeralCoalescer::flush);
+}
+
+void
+EphemeralCoalescer::readEvent(const QString &room_id, const QString &event_id)
+{
+        if (event_id.isEmpty())
+                return;
+
+        pendingReceipts_[room_id] = event_id;
+
+        if (!flushTimer_.isActive())
+                flushTimer_.start();
+}
+
+void
+EphemeralCoalescer::setTyping(const QString &room_id, bool typing, int timeoutInMillis)
+{
+        auto &state     = typing_[room_id];
+        state.requested = typing;
+        state.pending   = true;
+
+        if (typing)
+                state.timeout = timeoutInMillis;
+
+        if (!flushTimer_.isActive())
+                flushTimer_.start();
+}
+
+void
+EphemeralCoalescer::clear()
+{
+        flushTimer_.stop();
+
+        pendingReceipts_.clear();
+        sentReceipts_.clear();
+        typing_.clear();
+}
+
+void
+EphemeralCoalescer::flush()
+{
+        flushReceipts();
+        flushTyping();
+}
+
+void
+EphemeralCoalescer::flushReceipts()
+{
+        auto receipts = std::move(pendingReceipts_);
+        pendingReceipts_.clear();
+
+        for (const auto &receipt : receipts) {
+                const auto &room_id  = receipt.first;
+                const auto &event_id = receipt.second;
+
+                if (sentReceipts_[room_id] == event_id || isRead(room_id, event_id))
+                        continue;
+
+                sentReceipts_[room_id] = event_id;
+                sendReceipt_(room_id, event_id);
+        }
+}
+
+void
+EphemeralCoalescer::flushTyping()
+{
+        const auto now = QDateTime::currentMSecsSinceEpoch();
+
+        for (auto &entry : typing_) {
+                auto &state = entry.second;
+
+                if (!state.pending)
+                        continue;
+
+                state.pending = false;
+
+                // The server drops the typing state on its own when the timeout expires.
+                const bool typing = state.typing && now - state.sent < state.timeout;
+
+                if (state.requested == typing) {
+                        // Refresh the notification only when it's about to expire.
+                        if (!typing || now - state.sent < state.timeout / 2)
+                                continue;
+                }
+
+                state.typing = state.requested;
+
+                if (state.typing)
+                        state.sent = now;
+
+                sendTyping_(entry.first, state.typing, state.timeout);
+        }
+}
+
+bool
+EphemeralCoalescer::isRead(const QString &room_id, const QString &event_id) const
+{
+        if (!cache::client())
+                return false;
+
+        QSettings settings;
+        const auto local_user = settings.value("auth/user_id").toString().toStdString();
+
+        for (const auto &receipt : cache::client()->readReceipts(event_id, room_id)) {
+                if (receipt.second == local_user)
+                        return true;
+        }
+
+        return false;
+}
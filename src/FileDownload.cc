@@ -0,0 +1,200 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QDebug>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QTimer>
+
+#include "FileDownload.h"
+
+namespace {
+//! How much of the body may be buffered in memory, before it's written to disk.
+constexpr qint64 READ_BUFFER_SIZE = 1024 * 1024;
+//! How many times an interrupted download is resumed.
+constexpr int MAX_RETRIES = 5;
+//! Backoff of the resumed requests.
+constexpr int RETRY_BASE_DELAY = 2000;
+constexpr int RETRY_MAX_DELAY  = 60 * 1000;
+}
+
+FileDownload::FileDownload(QNetworkAccessManager *manager,
+                           const QUrl &url,
+                           const QString &filename,
+                           QObject *parent)
+  : QObject(parent)
+  , manager_{manager}
+  , url_{url}
+  , filename_{filename}
+  , part_{filename + ".part"}
+  , retry_{RETRY_BASE_DELAY, RETRY_MAX_DELAY}
+{}
+
+void
+FileDownload::start()
+{
+        if (!part_.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+                fail(part_.errorString());
+                return;
+        }
+
+        sendRequest();
+}
+
+void
+FileDownload::cancel()
+{
+        abortReply();
+
+        part_.close();
+        part_.remove();
+        deleteLater();
+}
+
+void
+FileDownload::abortReply()
+{
+        if (!reply_)
+                return;
+
+        // Detach first, so the handlers ignore the signals emitted by abort().
+        auto reply = reply_;
+        reply_     = nullptr;
+
+        reply->abort();
+        reply->deleteLater();
+}
+
+void
+FileDownload::sendRequest()
+{
+        QNetworkRequest request(url_);
+
+        rangeRequested_ = received_ > 0;
+
+        if (rangeRequested_)
+                request.setRawHeader("Range", QString("bytes=%1-").arg(received_).toUtf8());
+
+        reply_ = manager_->get(request);
+        reply_->setReadBufferSize(READ_BUFFER_SIZE);
+
+        auto reply = reply_;
+        connect(reply, &QNetworkReply::readyRead, this, [this, reply]() {
+                if (reply == reply_)
+                        readBody();
+        });
+        connect(reply, &QNetworkReply::finished, this, [this, reply]() {
+                if (reply == reply_)
+                        replyFinished();
+        });
+}
+
+void
+FileDownload::readBody()
+{
+        int status = reply_->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+
+        if (status >= 400)
+                return;
+
+        if (rangeRequested_) {
+                rangeRequested_ = false;
+
+                // The server ignored the range and sends the whole file again.
+                if (status == 200) {
+                        received_ = 0;
+                        total_    = -1;
+                        part_.resize(0);
+                        part_.seek(0);
+                }
+        }
+
+        if (total_ < 0) {
+                const auto length = reply_->header(QNetworkRequest::ContentLengthHeader);
+
+                if (length.isValid())
+                        total_ = received_ + length.toLongLong();
+        }
+
+        const auto chunk = reply_->readAll();
+
+        if (part_.write(chunk) != chunk.size()) {
+                abortReply();
+                fail(part_.errorString());
+                return;
+        }
+
+        received_ += chunk.size();
+        retry_.succeeded();
+
+        emit progress(received_, total_);
+}
+
+void
+FileDownload::replyFinished()
+{
+        auto reply = reply_;
+        reply_     = nullptr;
+        reply->deleteLater();
+
+        int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+
+        if (status >= 400 && !RetryPolicy::isTransient(reply)) {
+                fail(reply->errorString());
+                return;
+        }
+
+        if (status == 0 || status >= 400 || reply->error()) {
+                if (retry_.failures() >= MAX_RETRIES) {
+                        fail(reply->errorString());
+                        return;
+                }
+
+                qWarning() << "download interrupted at" << received_ << "bytes, resuming:"
+                           << url_.toString() << reply->errorString();
+
+                QTimer::singleShot(
+                  retry_.failed(reply, reply->readAll()), this, [this]() { sendRequest(); });
+                return;
+        }
+
+        part_.close();
+
+        // Replace the file the user chose.
+        QFile::remove(filename_);
+
+        if (!part_.rename(filename_)) {
+                fail(part_.errorString());
+                return;
+        }
+
+        emit finished(filename_);
+        deleteLater();
+}
+
+void
+FileDownload::fail(const QString &msg)
+{
+        qWarning() << "download failed:" << url_.toString() << msg;
+
+        part_.close();
+        part_.remove();
+
+        emit failed(msg);
+        deleteLater();
+}
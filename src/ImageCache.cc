@@ -0,0 +1,58 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QCache>
+
+#include "ImageCache.h"
+
+namespace {
+//! Upper bound of the memory used by the cached images.
+constexpr int MAX_CACHE_BYTES = 64 * 1024 * 1024;
+
+QCache<QString, QImage> &
+images()
+{
+        static QCache<QString, QImage> cache(MAX_CACHE_BYTES);
+        return cache;
+}
+}
+
+QString
+imagecache::key(const QString &url, const QSize &size)
+{
+        return QString("%1 %2x%3").arg(url).arg(size.width()).arg(size.height());
+}
+
+QImage
+imagecache::find(const QString &key)
+{
+        auto img = images().object(key);
+
+        if (!img)
+                return QImage();
+
+        return *img;
+}
+
+void
+imagecache::insert(const QString &key, const QImage &img)
+{
+        if (img.isNull())
+                return;
+
+        images().insert(key, new QImage(img), img.byteCount());
+}
@@ -15,8 +15,10 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <QCoreApplication>
 #include <QDebug>
 #include <QFile>
+#include <QFutureWatcher>
 #include <QImageReader>
 #include <QJsonArray>
 #include <QJsonDocument>
@@ -27,14 +29,42 @@
 #include <QPixmap>
 #include <QProcessEnvironment>
 #include <QSettings>
+#include <QStandardPaths>
+#include <QTimer>
 #include <QUrlQuery>
 #include <QtConcurrent>
+#include <algorithm>
+#include <limits>
 #include <mtx/errors.hpp>
 
+#include "Cache.h"
 #include "MatrixClient.h"
+#include "SyncParser.h"
 
 namespace {
 std::unique_ptr<MatrixClient> instance_ = nullptr;
+
+//! Bumped whenever the default filter changes, so that the one uploaded
+//! with an older version is replaced.
+constexpr int SYNC_FILTER_VERSION = 2;
+
+//! Size limit of the http cache.
+constexpr qint64 HTTP_CACHE_SIZE = 10 * 1024 * 1024;
+
+//! Number of transaction ids that are reserved in the cache at once.
+constexpr int TRANSACTION_ID_BLOCK = 100;
+
+//! Backoff of the message sends.
+constexpr int SEND_RETRY_BASE_DELAY = 1000;
+constexpr int SEND_RETRY_MAX_DELAY  = 30 * 1000;
+
+//! Number of bytes that are inspected to detect the type of an upload.
+constexpr qint64 MIME_HEADER_SIZE = 512;
+
+//! Number of notifications that are requested at once.
+constexpr int NOTIFICATIONS_PAGE_SIZE = 10;
+//! Upper bound of the pages that are retrieved to catch up with the new notifications.
+constexpr int MAX_NOTIFICATION_PAGES = 5;
 }
 
 namespace http {
@@ -58,8 +88,39 @@ MatrixClient::MatrixClient(QObject *parent)
   , clientApiUrl_{"/_matrix/client/r0"}
   , mediaApiUrl_{"/_matrix/media/r0"}
   , serverProtocol_{"https"}
+  , tlsSessions_{QString("%1/tls_session.json")
+                   .arg(QStandardPaths::writableLocation(QStandardPaths::CacheLocation))}
+  , syncLane_{new NetworkLane(&tlsSessions_, this)}
+  , mediaLane_{new NetworkLane(&tlsSessions_, this)}
+  , media_{new MediaScheduler(mediaLane_, this)}
+  , httpCache_{new QNetworkDiskCache(this)}
+  , uploads_{new UploadQueue(
+      [this](QSharedPointer<QIODevice> data) { return makeUploadRequest(data); },
+      this)}
+  , ephemeral_{new EphemeralCoalescer(
+      [this](const QString &room_id, const QString &event_id) {
+              sendReadMarkers(room_id, event_id);
+      },
+      [this](const QString &room_id, bool typing, int timeoutInMillis) {
+              sendTypingState(room_id, typing, timeoutInMillis);
+      },
+      this)}
 {
-        qRegisterMetaType<mtx::responses::Sync>();
+        qRegisterMetaType<SyncSnapshot>();
+        qRegisterMetaType<RoomMembers>();
+
+        httpCache_->setCacheDirectory(
+          QString("%1/http").arg(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)));
+        httpCache_->setMaximumCacheSize(HTTP_CACHE_SIZE);
+
+        // The latest TLS session ticket is only kept in memory while running.
+        connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit, this, [this]() {
+                tlsSessions_.flush();
+        });
+
+        connect(uploads_, &UploadQueue::failed, this, &MatrixClient::uploadFailed);
+        connect(uploads_, &UploadQueue::canceled, this, &MatrixClient::uploadCanceled);
+        connect(uploads_, &UploadQueue::progress, this, &MatrixClient::uploadProgress);
 
         QSettings settings;
         txn_id_ = settings.value("client/transaction_id", 1).toInt();
@@ -68,13 +129,29 @@ MatrixClient::MatrixClient(QObject *parent)
 
         auto allowInsecureConnections = env.value("NHEKO_ALLOW_INSECURE_CONNECTIONS", "0");
 
-        if (allowInsecureConnections == "1") {
+        if (allowInsecureConnections == "1")
                 qWarning() << "Insecure connections are allowed: SSL errors will be ignored";
-                connect(
-                  this,
-                  &QNetworkAccessManager::sslErrors,
-                  this,
-                  [](QNetworkReply *reply, const QList<QSslError> &) { reply->ignoreSslErrors(); });
+
+        for (QNetworkAccessManager *manager : {static_cast<QNetworkAccessManager *>(this),
+                                               static_cast<QNetworkAccessManager *>(syncLane_),
+                                               static_cast<QNetworkAccessManager *>(mediaLane_)}) {
+                if (allowInsecureConnections == "1") {
+                        connect(manager,
+                                &QNetworkAccessManager::sslErrors,
+                                this,
+                                [](QNetworkReply *reply, const QList<QSslError> &) {
+                                        reply->ignoreSslErrors();
+                                });
+                }
+
+                connect(manager,
+                        &QNetworkAccessManager::networkAccessibleChanged,
+                        manager,
+                        [manager](NetworkAccessibility status) {
+                                if (status != NetworkAccessibility::Accessible)
+                                        manager->setNetworkAccessible(
+                                          NetworkAccessibility::Accessible);
+                        });
         }
 
         QJsonObject default_filter{
@@ -82,6 +159,18 @@ MatrixClient::MatrixClient(QObject *parent)
             "room",
             QJsonObject{
               {"include_leave", true},
+              {
+                "state",
+                QJsonObject{
+                  {"lazy_load_members", true},
+                },
+              },
+              {
+                "timeline",
+                QJsonObject{
+                  {"lazy_load_members", true},
+                },
+              },
               {
                 "account_data",
                 QJsonObject{
@@ -104,18 +193,96 @@ MatrixClient::MatrixClient(QObject *parent)
           },
         };
 
-        filter_ = settings
-                    .value("client/sync_filter",
-                           QJsonDocument(default_filter).toJson(QJsonDocument::Compact))
-                    .toString();
+        // The initial sync only needs enough to populate the room list. The rest of the
+        // history is retrieved in the background.
+        auto room_filter     = default_filter["room"].toObject();
+        auto timeline_filter = room_filter["timeline"].toObject();
 
-        connect(this,
-                &QNetworkAccessManager::networkAccessibleChanged,
-                this,
-                [this](NetworkAccessibility status) {
-                        if (status != NetworkAccessibility::Accessible)
-                                setNetworkAccessible(NetworkAccessibility::Accessible);
-                });
+        timeline_filter["limit"] = 1;
+        room_filter["timeline"]  = timeline_filter;
+
+        auto initial_filter    = default_filter;
+        initial_filter["room"] = room_filter;
+
+        initial_filter_ = QJsonDocument(initial_filter).toJson(QJsonDocument::Compact);
+
+        const auto default_filter_json =
+          QString(QJsonDocument(default_filter).toJson(QJsonDocument::Compact));
+
+        if (settings.value("client/sync_filter_version", 1).toInt() == SYNC_FILTER_VERSION)
+                filter_ = settings.value("client/sync_filter", default_filter_json).toString();
+        else
+                filter_ = default_filter_json;
+}
+
+void
+setupProtocol(QNetworkRequest &request)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 8, 0)
+        // Multiplex the requests of a lane over a single connection, if the server supports it.
+        request.setAttribute(QNetworkRequest::HTTP2AllowedAttribute, true);
+#endif
+}
+
+NetworkLane::NetworkLane(TlsSessionStore *sessions, QObject *parent)
+  : QNetworkAccessManager(parent)
+  , sessions_{sessions}
+{}
+
+QNetworkReply *
+NetworkLane::createRequest(Operation op, const QNetworkRequest &req, QIODevice *outgoingData)
+{
+        QNetworkRequest request(req);
+        setupProtocol(request);
+        sessions_->apply(request);
+
+        auto reply = QNetworkAccessManager::createRequest(op, request, outgoingData);
+        sessions_->track(reply);
+
+        return reply;
+}
+
+QNetworkReply *
+MatrixClient::createRequest(Operation op, const QNetworkRequest &req, QIODevice *outgoingData)
+{
+        // Everything that isn't sent through a lane is initiated by the user.
+        QNetworkRequest request(req);
+        setupProtocol(request);
+        tlsSessions_.apply(request);
+
+        auto reply = QNetworkAccessManager::createRequest(op, request, outgoingData);
+        tlsSessions_.track(reply);
+
+        // The lanes don't share a request queue, so the media downloads
+        // make room for the user's requests explicitly.
+        interactiveRequests_ += 1;
+        media_->holdBack(true);
+
+        connect(reply, &QNetworkReply::finished, this, [this]() {
+                interactiveRequests_ -= 1;
+
+                if (interactiveRequests_ == 0)
+                        media_->holdBack(false);
+        });
+
+        return reply;
+}
+
+void
+MatrixClient::prewarmConnections() noexcept
+{
+        if (server_.scheme() != "https")
+                return;
+
+        const auto host   = server_.host();
+        const auto port   = static_cast<quint16>(server_.port(443));
+        const auto config = tlsSessions_.configuration(host);
+
+        // The handshakes happen while the cache is being loaded.
+        for (QNetworkAccessManager *manager : {static_cast<QNetworkAccessManager *>(this),
+                                               static_cast<QNetworkAccessManager *>(syncLane_),
+                                               static_cast<QNetworkAccessManager *>(mediaLane_)})
+                manager->connectToHostEncrypted(host, port, config);
 }
 
 void
@@ -125,7 +292,47 @@ MatrixClient::reset() noexcept
         server_.clear();
         token_.clear();
 
-        txn_id_ = 0;
+        txn_id_          = 0;
+        reserved_txn_id_ = 0;
+
+        fetchingNotifications_ = false;
+        notificationsOutdated_ = false;
+
+        // The cached responses belong to the previous account.
+        httpCache_->clear();
+        tlsSessions_.clear();
+
+        uploads_->cancel();
+        ephemeral_->clear();
+        sendRetry_.clear();
+}
+
+int
+MatrixClient::incrementTransactionId()
+{
+        txn_id_ += 1;
+
+        // The ids are reserved in blocks, so that sending a message doesn't have to wait
+        // for the counter to be written. The unused ids of a block are skipped on restart.
+        if (txn_id_ > reserved_txn_id_) {
+                reserved_txn_id_ = txn_id_ + TRANSACTION_ID_BLOCK;
+                cache::client()->saveTransactionId(reserved_txn_id_);
+
+                // The cache is wiped on format changes & errors, while the access token
+                // (and with it the scope of the ids) stays the same. Reusing an id would
+                // have the server drop the message as a retransmission.
+                QSettings settings;
+                settings.setValue("client/transaction_id", reserved_txn_id_);
+        }
+
+        return txn_id_;
+}
+
+void
+MatrixClient::restoreTransactionId(int txn_id)
+{
+        txn_id_          = std::max(txn_id_, txn_id);
+        reserved_txn_id_ = txn_id_;
 }
 
 void
@@ -321,16 +528,19 @@ MatrixClient::sync() noexcept
         QNetworkRequest request(QString(endpoint.toEncoded()));
         setupAuth(request);
 
-        auto reply = get(request);
-        connect(reply, &QNetworkReply::finished, this, [this, reply]() {
+        const auto since = next_batch_;
+
+        auto reply  = syncLane_->get(request);
+        auto buffer = bufferReply(reply);
+        connect(reply, &QNetworkReply::finished, this, [this, reply, buffer, since]() {
                 reply->deleteLater();
 
                 int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
-                auto data  = reply->readAll();
+                buffer->append(reply->readAll());
 
                 if (status == 0 || status >= 400) {
                         try {
-                                mtx::errors::Error res = nlohmann::json::parse(data);
+                                mtx::errors::Error res = nlohmann::json::parse(*buffer);
 
                                 if (res.errcode == mtx::errors::ErrorCode::M_UNKNOWN_TOKEN) {
                                         emit invalidToken();
@@ -338,18 +548,40 @@ MatrixClient::sync() noexcept
                                 }
 
                                 emit syncError(QString::fromStdString(res.error));
-
-                                return;
                         } catch (const nlohmann::json::exception &e) {
                                 qWarning() << e.what();
                         }
-                }
 
-                try {
-                        emit syncCompleted(nlohmann::json::parse(std::move(data)));
-                } catch (std::exception &e) {
-                        qWarning() << "Sync error: " << e.what();
+                        emit syncFailed(RetryPolicy::serverDelay(reply, *buffer));
+                        return;
                 }
+
+                auto watcher = new QFutureWatcher<SyncSnapshot>(this);
+                connect(watcher,
+                        &QFutureWatcher<SyncSnapshot>::finished,
+                        this,
+                        [this, watcher, since]() {
+                                watcher->deleteLater();
+
+                                // The sync was restarted from another token in the meantime.
+                                if (since != next_batch_)
+                                        return;
+
+                                const auto res = watcher->result();
+
+                                if (res.isNull())
+                                        emit syncFailed();
+                                else
+                                        emit syncCompleted(res);
+                        });
+                watcher->setFuture(QtConcurrent::run([buffer]() {
+                        try {
+                                return snapshot::create(syncparser::parse(*buffer));
+                        } catch (std::exception &e) {
+                                qWarning() << "Sync error: " << e.what();
+                                return SyncSnapshot();
+                        }
+                }));
         });
 }
 
@@ -404,15 +636,30 @@ MatrixClient::sendRoomMessage(mtx::events::MessageType ty,
 
                 int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
 
+                auto data = reply->readAll();
+
+                // A failing room doesn't delay the messages of the others.
+                const RetryPolicy policy{SEND_RETRY_BASE_DELAY, SEND_RETRY_MAX_DELAY};
+                auto &retry = sendRetry_.emplace(roomid, policy).first->second;
+
                 if (status == 0 || status >= 400) {
-                        emit messageSendFailed(roomid, txnId);
+                        if (RetryPolicy::isTransient(reply)) {
+                                emit messageSendFailed(
+                                  roomid, txnId, retry.failed(reply, data));
+                                return;
+                        }
+
+                        // e.g the message is too large or we're not allowed to post.
+                        auto error = QJsonDocument::fromJson(data).object().value("error");
+                        qWarning() << "message rejected:" << status << roomid << error;
+
+                        emit messageSendRejected(
+                          roomid, txnId, error.toString(reply->errorString()));
                         return;
                 }
 
-                auto data = reply->readAll();
-
                 if (data.isEmpty()) {
-                        emit messageSendFailed(roomid, txnId);
+                        emit messageSendFailed(roomid, txnId, retry.failed());
                         return;
                 }
 
@@ -420,7 +667,7 @@ MatrixClient::sendRoomMessage(mtx::events::MessageType ty,
 
                 if (!json.isObject()) {
                         qDebug() << "Send message response is not a JSON object";
-                        emit messageSendFailed(roomid, txnId);
+                        emit messageSendFailed(roomid, txnId, retry.failed());
                         return;
                 }
 
@@ -428,10 +675,13 @@ MatrixClient::sendRoomMessage(mtx::events::MessageType ty,
 
                 if (!object.contains("event_id")) {
                         qDebug() << "SendTextMessage: missing event_id from response";
-                        emit messageSendFailed(roomid, txnId);
+                        emit messageSendFailed(roomid, txnId, retry.failed());
                         return;
                 }
 
+                // Nothing to back off from anymore.
+                sendRetry_.erase(roomid);
+
                 emit messageSent(object.value("event_id").toString(), roomid, txnId);
         });
 }
@@ -441,7 +691,7 @@ MatrixClient::initialSync() noexcept
 {
         QUrlQuery query;
         query.addQueryItem("timeout", "0");
-        query.addQueryItem("filter", filter_);
+        query.addQueryItem("filter", initial_filter_);
 
         QUrl endpoint(server_);
         endpoint.setPath(clientApiUrl_ + "/sync");
@@ -450,21 +700,24 @@ MatrixClient::initialSync() noexcept
         QNetworkRequest request(QString(endpoint.toEncoded()));
         setupAuth(request);
 
-        auto reply = get(request);
-        connect(reply, &QNetworkReply::finished, this, [this, reply]() {
+        auto reply  = syncLane_->get(request);
+        auto buffer = bufferReply(reply);
+        connect(reply, &QNetworkReply::finished, this, [this, reply, buffer]() {
                 reply->deleteLater();
 
                 int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+                buffer->append(reply->readAll());
 
                 if (status == 0 || status >= 400) {
                         qDebug() << "Error code received" << status;
-                        emit initialSyncFailed(status);
+                        emit initialSyncFailed(status, RetryPolicy::serverDelay(reply, *buffer));
                         return;
                 }
 
-                QtConcurrent::run([data = reply->readAll(), this]() {
+                QtConcurrent::run([buffer, this]() {
                         try {
-                                emit initialSyncCompleted(nlohmann::json::parse(std::move(data)));
+                                emit initialSyncCompleted(
+                                  snapshot::create(syncparser::parse(*buffer)));
                         } catch (std::exception &e) {
                                 qWarning() << "Initial sync error:" << e.what();
                                 emit initialSyncFailed();
@@ -473,46 +726,142 @@ MatrixClient::initialSync() noexcept
         });
 }
 
+QSharedPointer<QByteArray>
+MatrixClient::bufferReply(QNetworkReply *reply)
+{
+        auto buffer = QSharedPointer<QByteArray>(new QByteArray);
+
+        // The headers are only known once they've been received.
+        connect(reply, &QNetworkReply::metaDataChanged, this, [reply, buffer]() {
+                const auto length =
+                  reply->header(QNetworkRequest::ContentLengthHeader).toLongLong();
+
+                if (buffer->isEmpty() && length > 0 && length < std::numeric_limits<int>::max())
+                        buffer->reserve(static_cast<int>(length));
+        });
+
+        // Drain the socket as the body arrives, instead of letting the
+        // reply accumulate (and reallocate) the whole payload.
+        connect(reply, &QNetworkReply::readyRead, this, [reply, buffer]() {
+                buffer->append(reply->readAll());
+        });
+
+        return buffer;
+}
+
 void
-MatrixClient::versions() noexcept
+MatrixClient::cachedGet(QNetworkRequest request,
+                        CachedHandler handler,
+                        CacheMissHandler onError,
+                        CachePolicy policy)
 {
-        QUrl endpoint(server_);
-        endpoint.setPath("/_matrix/client/versions");
+        const auto url = request.url();
 
-        QNetworkRequest request(endpoint);
+        QByteArray cached;
+        if (auto device = std::unique_ptr<QIODevice>(httpCache_->data(url)))
+                cached = device->readAll();
+
+        if (!cached.isEmpty()) {
+                // Revalidate the cached response, if the server gave us the means to.
+                for (const auto &header : httpCache_->metaData(url).rawHeaders()) {
+                        const auto name = header.first.toLower();
+
+                        if (name == "etag")
+                                request.setRawHeader("If-None-Match", header.second);
+                        else if (name == "last-modified")
+                                request.setRawHeader("If-Modified-Since", header.second);
+                }
+
+                if (policy == CachePolicy::StaleWhileRevalidate)
+                        QTimer::singleShot(0, this, [handler, cached]() { handler(cached); });
+        }
+
+        const bool revalidate = policy == CachePolicy::Revalidate;
 
         auto reply = get(request);
-        connect(reply, &QNetworkReply::finished, this, [this, reply]() {
-                reply->deleteLater();
+        connect(reply,
+                &QNetworkReply::finished,
+                this,
+                [this, reply, url, cached, handler, onError, revalidate]() {
+                        reply->deleteLater();
 
-                int status_code =
-                  reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+                        int status =
+                          reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
 
-                if (reply->error()) {
-                        emit versionError(reply->errorString());
-                        return;
-                }
+                        // Not modified; the cached response is still current.
+                        if (status == 304) {
+                                if (revalidate)
+                                        handler(cached);
 
-                if (status_code == 404) {
-                        emit versionError("Versions endpoint was not found on the server. Possibly "
-                                          "not a Matrix server");
-                        return;
-                }
+                                return;
+                        }
 
-                if (status_code >= 400) {
-                        emit versionError("An unknown error occured. Please try again.");
-                        return;
-                }
+                        if (reply->error() || status == 0 || status >= 400) {
+                                if ((cached.isEmpty() || revalidate) && onError)
+                                        onError(reply);
+                                else
+                                        qWarning() << url.toString() << reply->errorString();
 
-                try {
-                        mtx::responses::Versions versions =
-                          nlohmann::json::parse(reply->readAll().data());
+                                return;
+                        }
 
-                        emit versionSuccess();
-                } catch (std::exception &e) {
-                        emit versionError("Malformed response. Possibly not a Matrix server");
-                }
-        });
+                        auto data = reply->readAll();
+
+                        QNetworkCacheMetaData metaData;
+                        metaData.setUrl(url);
+                        metaData.setSaveToDisk(true);
+                        metaData.setRawHeaders(reply->rawHeaderPairs());
+
+                        if (auto device = httpCache_->prepare(metaData)) {
+                                device->write(data);
+                                httpCache_->insert(device);
+                        }
+
+                        if (data != cached || revalidate)
+                                handler(data);
+                });
+}
+
+void
+MatrixClient::versions() noexcept
+{
+        QUrl endpoint(server_);
+        endpoint.setPath("/_matrix/client/versions");
+
+        QNetworkRequest request(endpoint);
+
+        // This is also the reachability check of the server, so a cached
+        // response is only used once the server confirmed it.
+        cachedGet(request,
+                  [this](const QByteArray &data) {
+                          try {
+                                  mtx::responses::Versions versions =
+                                    nlohmann::json::parse(data.data());
+
+                                  emit versionSuccess();
+                          } catch (std::exception &e) {
+                                  emit versionError(
+                                    "Malformed response. Possibly not a Matrix server");
+                          }
+                  },
+                  [this](QNetworkReply *reply) {
+                          int status_code =
+                            reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+
+                          if (reply->error()) {
+                                  emit versionError(reply->errorString());
+                                  return;
+                          }
+
+                          if (status_code == 404) {
+                                  emit versionError("Versions endpoint was not found on the "
+                                                    "server. Possibly not a Matrix server");
+                                  return;
+                          }
+
+                          emit versionError("An unknown error occured. Please try again.");
+                  },
+                  CachePolicy::Revalidate);
 }
 
 void
@@ -529,20 +878,9 @@ MatrixClient::getOwnProfile() noexcept
         QNetworkRequest request(QString(endpoint.toEncoded()));
         setupAuth(request);
 
-        QNetworkReply *reply = get(request);
-        connect(reply, &QNetworkReply::finished, this, [this, reply]() {
-                reply->deleteLater();
-
-                int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
-
-                if (status >= 400) {
-                        qWarning() << reply->errorString();
-                        return;
-                }
-
+        cachedGet(request, [this](const QByteArray &data) {
                 try {
-                        mtx::responses::Profile profile =
-                          nlohmann::json::parse(reply->readAll().data());
+                        mtx::responses::Profile profile = nlohmann::json::parse(data.data());
 
                         emit getOwnProfileResponse(QUrl(QString::fromStdString(profile.avatar_url)),
                                                    QString::fromStdString(profile.display_name));
@@ -553,26 +891,65 @@ MatrixClient::getOwnProfile() noexcept
 }
 
 void
-MatrixClient::getOwnCommunities() noexcept
+MatrixClient::getRoomMembers(const QString &room_id) noexcept
 {
         QUrl endpoint(server_);
-        endpoint.setPath(clientApiUrl_ + "/joined_groups");
+        endpoint.setPath(clientApiUrl_ + QString("/rooms/%1/members").arg(room_id));
 
         QNetworkRequest request(QString(endpoint.toEncoded()));
         setupAuth(request);
 
-        QNetworkReply *reply = get(request);
-        connect(reply, &QNetworkReply::finished, this, [this, reply]() {
+        auto reply  = get(request);
+        auto buffer = bufferReply(reply);
+        connect(reply, &QNetworkReply::finished, this, [this, reply, buffer, room_id]() {
                 reply->deleteLater();
 
                 int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
 
-                if (status >= 400) {
-                        qWarning() << reply->errorString();
+                if (status == 0 || status >= 400) {
+                        qWarning() << "failed to retrieve members of" << room_id
+                                   << reply->errorString();
+                        emit roomMembersFailed(room_id);
                         return;
                 }
 
-                auto data = reply->readAll();
+                buffer->append(reply->readAll());
+
+                // The member list of large rooms is big enough to stall the UI.
+                QtConcurrent::run([this, buffer, room_id]() {
+                        using Member = mtx::events::StateEvent<mtx::events::state::Member>;
+
+                        try {
+                                const auto res = nlohmann::json::parse(*buffer);
+
+                                RoomMembers members;
+                                for (const auto &event : res.at("chunk")) {
+                                        try {
+                                                members.emplace_back(event.get<Member>());
+                                        } catch (const nlohmann::json::exception &e) {
+                                                qWarning() << "Members:" << e.what();
+                                        }
+                                }
+
+                                emit roomMembersRetrieved(room_id, members);
+                        } catch (const std::exception &e) {
+                                qWarning() << "Members:" << e.what();
+                                emit roomMembersFailed(room_id);
+                        }
+                });
+        });
+}
+
+void
+MatrixClient::getOwnCommunities() noexcept
+{
+        QUrl endpoint(server_);
+        endpoint.setPath(clientApiUrl_ + "/joined_groups");
+
+        QNetworkRequest request(QString(endpoint.toEncoded()));
+        setupAuth(request);
+
+        cachedGet(request, [this](const QByteArray &data) {
                 auto json = QJsonDocument::fromJson(data).object();
 
                 if (!json.contains("groups")) {
@@ -589,98 +966,50 @@ MatrixClient::getOwnCommunities() noexcept
 }
 
 void
-MatrixClient::fetchRoomAvatar(const QString &roomid, const QUrl &avatar_url)
+MatrixClient::fetchRoomAvatar(const QString &roomid, const QUrl &avatar_url, AvatarTier tier)
 {
-        QList<QString> url_parts = avatar_url.toString().split("mxc://");
+        const auto size     = AvatarProvider::resolution(tier);
+        const auto endpoint = thumbnailUrl(avatar_url, size, "crop");
 
-        if (url_parts.size() != 2) {
+        if (endpoint.isEmpty()) {
                 qDebug() << "Invalid format for room avatar " << avatar_url.toString();
                 return;
         }
 
-        QUrlQuery query;
-        query.addQueryItem("width", "512");
-        query.addQueryItem("height", "512");
-        query.addQueryItem("method", "crop");
-
-        QString media_url =
-          QString("%1/_matrix/media/r0/thumbnail/%2").arg(getHomeServer().toString(), url_parts[1]);
-
-        QUrl endpoint(media_url);
-        endpoint.setQuery(query);
-
-        QNetworkRequest avatar_request(endpoint);
-
-        QNetworkReply *reply = get(avatar_request);
-        connect(reply, &QNetworkReply::finished, this, [this, reply, roomid, avatar_url]() {
-                reply->deleteLater();
-
-                int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
-
-                if (status == 0 || status >= 400) {
-                        qWarning() << reply->errorString();
-                        return;
-                }
-
-                auto img = reply->readAll();
-
-                if (img.size() == 0)
-                        return;
-
-                QPixmap pixmap;
-                pixmap.loadFromData(img);
-
-                emit roomAvatarRetrieved(roomid, pixmap, avatar_url.toString(), img);
-        });
+        media_->fetchImage(endpoint,
+                           this,
+                           size,
+                           [this, roomid, avatar_url](const QImage &img, const QByteArray &data) {
+                                   emit roomAvatarRetrieved(roomid,
+                                                            QPixmap::fromImage(img),
+                                                            avatar_url.toString(),
+                                                            data);
+                           });
 }
 
 void
-MatrixClient::fetchCommunityAvatar(const QString &communityId, const QUrl &avatar_url)
+MatrixClient::fetchCommunityAvatar(const QString &communityId,
+                                   const QUrl &avatar_url,
+                                   AvatarTier tier)
 {
         if (avatar_url.isEmpty())
                 return;
 
-        QList<QString> url_parts = avatar_url.toString().split("mxc://");
+        const auto size     = AvatarProvider::resolution(tier);
+        const auto endpoint = thumbnailUrl(avatar_url, size, "crop");
 
-        if (url_parts.size() != 2) {
+        if (endpoint.isEmpty()) {
                 qDebug() << "Invalid format for community avatar " << avatar_url.toString();
                 return;
         }
 
-        QUrlQuery query;
-        query.addQueryItem("width", "512");
-        query.addQueryItem("height", "512");
-        query.addQueryItem("method", "crop");
-
-        QString media_url =
-          QString("%1/_matrix/media/r0/thumbnail/%2").arg(getHomeServer().toString(), url_parts[1]);
-
-        QUrl endpoint(media_url);
-        endpoint.setQuery(query);
-
-        QNetworkRequest avatar_request(endpoint);
-
-        QNetworkReply *reply = get(avatar_request);
-        connect(reply, &QNetworkReply::finished, this, [this, reply, communityId]() {
-                reply->deleteLater();
-
-                int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
-
-                if (status == 0 || status >= 400) {
-                        qWarning() << reply->errorString();
-                        return;
-                }
-
-                auto img = reply->readAll();
-
-                if (img.size() == 0)
-                        return;
-
-                QPixmap pixmap;
-                pixmap.loadFromData(img);
-
-                emit communityAvatarRetrieved(communityId, pixmap);
-        });
+        media_->fetchImage(endpoint,
+                           this,
+                           size,
+                           [this, communityId](const QImage &img, const QByteArray &) {
+                                   emit communityAvatarRetrieved(communityId,
+                                                                 QPixmap::fromImage(img));
+                           });
 }
 
 void
@@ -692,19 +1021,7 @@ MatrixClient::fetchCommunityProfile(const QString &communityId)
         QNetworkRequest request(QString(endpoint.toEncoded()));
         setupAuth(request);
 
-        QNetworkReply *reply = get(request);
-
-        connect(reply, &QNetworkReply::finished, this, [this, reply, communityId]() {
-                reply->deleteLater();
-
-                int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
-
-                if (status >= 400) {
-                        qWarning() << reply->errorString();
-                        return;
-                }
-
-                auto data       = reply->readAll();
+        cachedGet(request, [this, communityId](const QByteArray &data) {
                 const auto json = QJsonDocument::fromJson(data).object();
 
                 emit communityProfileRetrieved(communityId, json);
@@ -720,18 +1037,7 @@ MatrixClient::fetchCommunityRooms(const QString &communityId)
         QNetworkRequest request(QString(endpoint.toEncoded()));
         setupAuth(request);
 
-        QNetworkReply *reply = get(request);
-        connect(reply, &QNetworkReply::finished, this, [this, reply, communityId]() {
-                reply->deleteLater();
-
-                int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
-
-                if (status >= 400) {
-                        qWarning() << reply->errorString();
-                        return;
-                }
-
-                auto data       = reply->readAll();
+        cachedGet(request, [this, communityId](const QByteArray &data) {
                 const auto json = QJsonDocument::fromJson(data).object();
 
                 emit communityRoomsRetrieved(communityId, json);
@@ -739,115 +1045,76 @@ MatrixClient::fetchCommunityRooms(const QString &communityId)
 }
 
 QSharedPointer<DownloadMediaProxy>
-MatrixClient::fetchUserAvatar(const QUrl &avatarUrl)
+MatrixClient::fetchUserAvatar(const QUrl &avatarUrl, AvatarTier tier)
 {
-        QList<QString> url_parts = avatarUrl.toString().split("mxc://");
+        const auto size     = AvatarProvider::resolution(tier);
+        const auto endpoint = thumbnailUrl(avatarUrl, size, "crop");
 
-        if (url_parts.size() != 2)
+        if (endpoint.isEmpty())
                 return QSharedPointer<DownloadMediaProxy>();
 
-        QUrlQuery query;
-        query.addQueryItem("width", "128");
-        query.addQueryItem("height", "128");
-        query.addQueryItem("method", "crop");
-
-        QString media_url =
-          QString("%1/_matrix/media/r0/thumbnail/%2").arg(getHomeServer().toString(), url_parts[1]);
-
-        QUrl endpoint(media_url);
-        endpoint.setQuery(query);
-
-        QNetworkRequest avatar_request(endpoint);
-
-        auto reply = get(avatar_request);
         auto proxy = QSharedPointer<DownloadMediaProxy>(new DownloadMediaProxy,
                                                         [](auto proxy) { proxy->deleteLater(); });
-        connect(reply, &QNetworkReply::finished, this, [reply, proxy, avatarUrl]() {
-                reply->deleteLater();
 
-                int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
-
-                if (status == 0 || status >= 400) {
-                        qWarning() << reply->errorString() << avatarUrl;
-                        return;
-                }
-
-                auto data = reply->readAll();
-
-                if (data.size() == 0) {
-                        qWarning() << "received avatar with no data:" << avatarUrl;
-                        return;
-                }
-
-                QImage img;
-                img.loadFromData(data);
-
-                emit proxy->avatarDownloaded(img);
-        });
+        // The download is cancelled if the proxy is released before it completes.
+        auto receiver = proxy.data();
+        media_->fetchImage(
+          endpoint, receiver, size, [receiver](const QImage &img, const QByteArray &data) {
+                  emit receiver->avatarDownloaded(img, data);
+          });
 
         return proxy;
 }
 
 QSharedPointer<DownloadMediaProxy>
-MatrixClient::downloadImage(const QUrl &url)
+MatrixClient::downloadImage(const QUrl &url,
+                            const QSize &size,
+                            MediaScheduler::Priority priority)
 {
-        QNetworkRequest image_request(url);
-
-        auto reply = get(image_request);
         auto proxy = QSharedPointer<DownloadMediaProxy>(new DownloadMediaProxy,
                                                         [](auto proxy) { proxy->deleteLater(); });
-        connect(reply, &QNetworkReply::finished, this, [reply, proxy]() {
-                reply->deleteLater();
 
-                int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
-
-                if (status == 0 || status >= 400) {
-                        qWarning() << reply->errorString();
-                        return;
-                }
-
-                auto img = reply->readAll();
-
-                if (img.size() == 0)
-                        return;
-
-                QPixmap pixmap;
-                pixmap.loadFromData(img);
-
-                emit proxy->imageDownloaded(pixmap);
-        });
+        auto receiver = proxy.data();
+        media_->fetchImage(url,
+                           receiver,
+                           size,
+                           [receiver](const QImage &img, const QByteArray &) {
+                                   emit receiver->imageDownloaded(img);
+                           },
+                           priority);
 
         return proxy;
 }
 
-QSharedPointer<DownloadMediaProxy>
-MatrixClient::downloadFile(const QUrl &url)
+QUrl
+MatrixClient::thumbnailUrl(const QUrl &mxc, const QSize &size, const QString &method)
 {
-        QNetworkRequest fileRequest(url);
+        QList<QString> url_parts = mxc.toString().split("mxc://");
 
-        auto reply = get(fileRequest);
-        auto proxy = QSharedPointer<DownloadMediaProxy>(new DownloadMediaProxy,
-                                                        [](auto proxy) { proxy->deleteLater(); });
-        connect(reply, &QNetworkReply::finished, this, [reply, proxy]() {
-                reply->deleteLater();
+        if (url_parts.size() != 2 || size.isEmpty())
+                return QUrl();
 
-                int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        QUrlQuery query;
+        query.addQueryItem("width", QString::number(size.width()));
+        query.addQueryItem("height", QString::number(size.height()));
+        query.addQueryItem("method", method);
 
-                if (status == 0 || status >= 400) {
-                        // TODO: Handle error
-                        qWarning() << reply->errorString();
-                        return;
-                }
+        QUrl endpoint(
+          QString("%1/_matrix/media/r0/thumbnail/%2").arg(getHomeServer().toString(), url_parts[1]));
+        endpoint.setQuery(query);
 
-                auto data = reply->readAll();
+        return endpoint;
+}
 
-                if (data.size() == 0)
-                        return;
+FileDownload *
+MatrixClient::downloadFile(const QUrl &url, const QString &filename)
+{
+        auto download = new FileDownload(mediaLane_, url, filename, this);
 
-                emit proxy->fileDownloaded(data);
-        });
+        // Let the caller connect to the signals first.
+        QTimer::singleShot(0, download, &FileDownload::start);
 
-        return proxy;
+        return download;
 }
 
 void
@@ -857,6 +1124,7 @@ MatrixClient::messages(const QString &roomid, const QString &from_token, int lim
         query.addQueryItem("from", from_token);
         query.addQueryItem("dir", "b");
         query.addQueryItem("limit", QString::number(limit));
+        query.addQueryItem("filter", "{\"lazy_load_members\":true}");
 
         QUrl endpoint(server_);
         endpoint.setPath(clientApiUrl_ + QString("/rooms/%1/messages").arg(roomid));
@@ -873,6 +1141,7 @@ MatrixClient::messages(const QString &roomid, const QString &from_token, int lim
 
                 if (status == 0 || status >= 400) {
                         qWarning() << reply->errorString();
+                        emit messagesFailed(roomid);
                         return;
                 }
 
@@ -883,6 +1152,7 @@ MatrixClient::messages(const QString &roomid, const QString &from_token, int lim
                         emit messagesRetrieved(roomid, messages);
                 } catch (std::exception &e) {
                         qWarning() << "Room messages from" << roomid << e.what();
+                        emit messagesFailed(roomid);
                         return;
                 }
         });
@@ -893,22 +1163,8 @@ MatrixClient::uploadImage(const QString &roomid,
                           const QString &filename,
                           const QSharedPointer<QIODevice> data)
 {
-        auto reply = makeUploadRequest(data);
-
-        if (reply == nullptr)
-                return;
-
-        connect(reply, &QNetworkReply::finished, this, [this, reply, roomid, filename, data]() {
-                auto json = getUploadReply(reply);
-                if (json.isEmpty())
-                        return;
-
-                auto mime = reply->request().header(QNetworkRequest::ContentTypeHeader).toString();
-                auto size =
-                  reply->request().header(QNetworkRequest::ContentLengthHeader).toLongLong();
-
-                emit imageUploaded(
-                  roomid, filename, json.value("content_uri").toString(), mime, size);
+        uploads_->enqueue(roomid, data, [this, roomid, filename](auto url, auto mime, auto size) {
+                emit imageUploaded(roomid, filename, url, mime, size);
         });
 }
 
@@ -917,22 +1173,8 @@ MatrixClient::uploadFile(const QString &roomid,
                          const QString &filename,
                          const QSharedPointer<QIODevice> data)
 {
-        auto reply = makeUploadRequest(data);
-
-        if (reply == nullptr)
-                return;
-
-        connect(reply, &QNetworkReply::finished, this, [this, reply, roomid, filename, data]() {
-                auto json = getUploadReply(reply);
-                if (json.isEmpty())
-                        return;
-
-                auto mime = reply->request().header(QNetworkRequest::ContentTypeHeader).toString();
-                auto size =
-                  reply->request().header(QNetworkRequest::ContentLengthHeader).toLongLong();
-
-                emit fileUploaded(
-                  roomid, filename, json.value("content_uri").toString(), mime, size);
+        uploads_->enqueue(roomid, data, [this, roomid, filename](auto url, auto mime, auto size) {
+                emit fileUploaded(roomid, filename, url, mime, size);
         });
 }
 
@@ -941,22 +1183,8 @@ MatrixClient::uploadAudio(const QString &roomid,
                           const QString &filename,
                           const QSharedPointer<QIODevice> data)
 {
-        auto reply = makeUploadRequest(data);
-
-        if (reply == nullptr)
-                return;
-
-        connect(reply, &QNetworkReply::finished, this, [this, reply, roomid, filename, data]() {
-                auto json = getUploadReply(reply);
-                if (json.isEmpty())
-                        return;
-
-                auto mime = reply->request().header(QNetworkRequest::ContentTypeHeader).toString();
-                auto size =
-                  reply->request().header(QNetworkRequest::ContentLengthHeader).toLongLong();
-
-                emit audioUploaded(
-                  roomid, filename, json.value("content_uri").toString(), mime, size);
+        uploads_->enqueue(roomid, data, [this, roomid, filename](auto url, auto mime, auto size) {
+                emit audioUploaded(roomid, filename, url, mime, size);
         });
 }
 
@@ -965,22 +1193,8 @@ MatrixClient::uploadVideo(const QString &roomid,
                           const QString &filename,
                           const QSharedPointer<QIODevice> data)
 {
-        auto reply = makeUploadRequest(data);
-
-        if (reply == nullptr)
-                return;
-
-        connect(reply, &QNetworkReply::finished, this, [this, reply, roomid, filename, data]() {
-                auto json = getUploadReply(reply);
-                if (json.isEmpty())
-                        return;
-
-                auto mime = reply->request().header(QNetworkRequest::ContentTypeHeader).toString();
-                auto size =
-                  reply->request().header(QNetworkRequest::ContentLengthHeader).toLongLong();
-
-                emit videoUploaded(
-                  roomid, filename, json.value("content_uri").toString(), mime, size);
+        uploads_->enqueue(roomid, data, [this, roomid, filename](auto url, auto mime, auto size) {
+                emit videoUploaded(roomid, filename, url, mime, size);
         });
 }
 
@@ -1023,6 +1237,7 @@ MatrixClient::uploadFilter(const QString &filter) noexcept
                 qDebug() << "Filter with ID" << filter_id << "created.";
                 QSettings settings;
                 settings.setValue("client/sync_filter", filter_id);
+                settings.setValue("client/sync_filter_version", SYNC_FILTER_VERSION);
                 settings.sync();
 
                 // set the filter_ var so following syncs will use it
@@ -1163,47 +1378,46 @@ MatrixClient::createRoom(const mtx::requests::CreateRoom &create_room_request)
 void
 MatrixClient::sendTypingNotification(const QString &roomid, int timeoutInMillis)
 {
-        QSettings settings;
-        QString user_id = settings.value("auth/user_id").toString();
-
-        QUrl endpoint(server_);
-        endpoint.setPath(clientApiUrl_ + QString("/rooms/%1/typing/%2").arg(roomid).arg(user_id));
-
-        QString msgType("");
-        QJsonObject body;
-
-        body = {{"typing", true}, {"timeout", timeoutInMillis}};
+        ephemeral_->setTyping(roomid, true, timeoutInMillis);
+}
 
-        QNetworkRequest request(QString(endpoint.toEncoded()));
-        request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
-        setupAuth(request);
+void
+MatrixClient::removeTypingNotification(const QString &roomid)
+{
+        ephemeral_->setTyping(roomid, false);
+}
 
-        put(request, QJsonDocument(body).toJson(QJsonDocument::Compact));
+void
+MatrixClient::readEvent(const QString &room_id, const QString &event_id)
+{
+        ephemeral_->readEvent(room_id, event_id);
 }
 
 void
-MatrixClient::removeTypingNotification(const QString &roomid)
+MatrixClient::sendTypingState(const QString &room_id, bool typing, int timeoutInMillis)
 {
         QSettings settings;
         QString user_id = settings.value("auth/user_id").toString();
 
         QUrl endpoint(server_);
-        endpoint.setPath(clientApiUrl_ + QString("/rooms/%1/typing/%2").arg(roomid).arg(user_id));
+        endpoint.setPath(clientApiUrl_ + QString("/rooms/%1/typing/%2").arg(room_id).arg(user_id));
 
-        QString msgType("");
-        QJsonObject body;
+        QJsonObject body = {{"typing", typing}};
 
-        body = {{"typing", false}};
+        if (typing)
+                body["timeout"] = timeoutInMillis;
 
         QNetworkRequest request(QString(endpoint.toEncoded()));
         request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
         setupAuth(request);
 
-        put(request, QJsonDocument(body).toJson(QJsonDocument::Compact));
+        auto reply = put(request, QJsonDocument(body).toJson(QJsonDocument::Compact));
+
+        connect(reply, &QNetworkReply::finished, reply, &QNetworkReply::deleteLater);
 }
 
 void
-MatrixClient::readEvent(const QString &room_id, const QString &event_id)
+MatrixClient::sendReadMarkers(const QString &room_id, const QString &event_id)
 {
         QUrl endpoint(server_);
         endpoint.setPath(clientApiUrl_ + QString("/rooms/%1/read_markers").arg(room_id));
@@ -1238,54 +1452,23 @@ MatrixClient::makeUploadRequest(QSharedPointer<QIODevice> iodev)
                 return nullptr;
         }
 
+        // The type is detected from the header of the content, without reading the whole of it.
         QMimeDatabase db;
-        QMimeType mime = db.mimeTypeForData(iodev.data());
+        QMimeType mime = db.mimeTypeForData(iodev->peek(MIME_HEADER_SIZE));
 
         QNetworkRequest request(QString(endpoint.toEncoded()));
         request.setHeader(QNetworkRequest::ContentTypeHeader, mime.name());
+        if (!iodev->isSequential())
+                request.setHeader(QNetworkRequest::ContentLengthHeader, iodev->size());
         setupAuth(request);
 
-        auto reply = post(request, iodev.data());
-
-        return reply;
+        return mediaLane_->post(request, iodev.data());
 }
 
-QJsonObject
-MatrixClient::getUploadReply(QNetworkReply *reply)
+void
+MatrixClient::cancelUploads()
 {
-        QJsonObject object;
-
-        reply->deleteLater();
-
-        int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
-
-        if (status == 0 || status >= 400) {
-                emit uploadFailed(status,
-                                  QString("Media upload failed - %1").arg(reply->errorString()));
-                return object;
-        }
-
-        auto res_data = reply->readAll();
-
-        if (res_data.isEmpty()) {
-                emit uploadFailed(status, "Media upload failed - Empty response");
-                return object;
-        }
-
-        auto json = QJsonDocument::fromJson(res_data);
-
-        if (!json.isObject()) {
-                emit uploadFailed(status, "Media upload failed - Invalid response");
-                return object;
-        }
-
-        object = json.object();
-        if (!object.contains("content_uri")) {
-                emit uploadFailed(status, "Media upload failed - Missing 'content_uri'");
-                return QJsonObject{};
-        }
-
-        return object;
+        uploads_->cancel();
 }
 
 void
@@ -1331,9 +1514,26 @@ MatrixClient::redactEvent(const QString &room_id, const QString &event_id)
 
 void
 MatrixClient::getNotifications() noexcept
+{
+        // The notifications that arrive in the meantime are retrieved afterwards.
+        if (fetchingNotifications_) {
+                notificationsOutdated_ = true;
+                return;
+        }
+
+        fetchingNotifications_ = true;
+
+        fetchNotifications("", cache::client()->newestNotificationTs(), 0);
+}
+
+void
+MatrixClient::fetchNotifications(const QString &from, uint64_t since, int page) noexcept
 {
         QUrlQuery query;
-        query.addQueryItem("limit", "5");
+        query.addQueryItem("limit", QString::number(NOTIFICATIONS_PAGE_SIZE));
+
+        if (!from.isEmpty())
+                query.addQueryItem("from", from);
 
         QUrl endpoint(server_);
         endpoint.setQuery(query);
@@ -1343,26 +1543,59 @@ MatrixClient::getNotifications() noexcept
         setupAuth(request);
 
         auto reply = get(request);
-        connect(reply, &QNetworkReply::finished, this, [reply, this]() {
+        connect(reply, &QNetworkReply::finished, this, [reply, this, since, page]() {
                 reply->deleteLater();
 
                 int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
                 auto data  = reply->readAll();
 
                 if (status == 0 || status >= 400) {
-                        try {
-                                mtx::errors::Error res = nlohmann::json::parse(data);
-                                std::cout << nlohmann::json::parse(data).dump(2) << '\n';
-                                // TODO: Response with an error signal
-                                return;
-                        } catch (const std::exception &) {
-                        }
+                        qWarning() << "failed to retrieve notifications" << status
+                                   << reply->errorString();
+                        finishNotifications();
+                        return;
                 }
 
+                mtx::responses::Notifications res;
+
                 try {
-                        emit notificationsRetrieved(nlohmann::json::parse(data));
+                        res = nlohmann::json::parse(data);
                 } catch (const std::exception &e) {
                         qWarning() << "failed to parse /notifications response" << e.what();
+                        finishNotifications();
+                        return;
+                }
+
+                // The notifications are ordered from the newest to the oldest.
+                // Everything after the newest one we've already seen is known.
+                auto seen = std::find_if(res.notifications.begin(),
+                                         res.notifications.end(),
+                                         [since](const auto &item) { return item.ts < since; });
+                const bool caughtUp = seen != res.notifications.end();
+
+                res.notifications.erase(seen, res.notifications.end());
+
+                if (!res.notifications.empty())
+                        emit notificationsRetrieved(res);
+
+                // Without a previous notification only the latest page is relevant.
+                if (caughtUp || since == 0 || res.next_token.empty() ||
+                    page + 1 >= MAX_NOTIFICATION_PAGES) {
+                        finishNotifications();
+                        return;
                 }
+
+                fetchNotifications(QString::fromStdString(res.next_token), since, page + 1);
         });
 }
+
+void
+MatrixClient::finishNotifications() noexcept
+{
+        fetchingNotifications_ = false;
+
+        if (notificationsOutdated_) {
+                notificationsOutdated_ = false;
+                getNotifications();
+        }
+}
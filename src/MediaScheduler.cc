@@ -0,0 +1,344 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+
+#include <QBuffer>
+#include <QDebug>
+#include <QFutureWatcher>
+#include <QImageReader>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QTimer>
+#include <QtConcurrent>
+
+#include "MediaScheduler.h"
+
+//! Maximum number of concurrent downloads.
+constexpr int MAX_ACTIVE_DOWNLOADS = 6;
+//! Maximum number of concurrent downloads while the scheduler is held back.
+constexpr int MAX_HELD_BACK_DOWNLOADS = 2;
+//! How many times a download is retried after a transient failure.
+constexpr int MAX_RETRIES = 3;
+//! Backoff of the failed downloads.
+constexpr int RETRY_BASE_DELAY = 1000;
+constexpr int RETRY_MAX_DELAY  = 30 * 1000;
+
+namespace {
+QImage
+decodeImage(const QByteArray &data, const QSize &max_size)
+{
+        QBuffer buffer;
+        buffer.setData(data);
+        buffer.open(QIODevice::ReadOnly);
+
+        QImageReader reader(&buffer);
+        reader.setAutoTransform(true);
+
+        // Let the decoder produce the final resolution directly
+        // (e.g JPEG can skip most of the work), instead of scaling afterwards.
+        const auto size = reader.size();
+        if (max_size.isValid() && size.isValid() &&
+            (size.width() > max_size.width() || size.height() > max_size.height()))
+                reader.setScaledSize(size.scaled(max_size, Qt::KeepAspectRatio));
+
+        const auto img = reader.read();
+
+        if (img.isNull())
+                qWarning() << "failed to decode image:" << reader.errorString();
+
+        return img;
+}
+}
+
+MediaScheduler::MediaScheduler(QNetworkAccessManager *manager, QObject *parent)
+  : QObject(parent)
+  , manager_{manager}
+  , retry_{RETRY_BASE_DELAY, RETRY_MAX_DELAY}
+{}
+
+void
+MediaScheduler::fetch(const QUrl &url, QObject *receiver, Callback callback, Priority priority)
+{
+        if (!receiver || url.isEmpty())
+                return;
+
+        enqueue(url, Waiter{receiver, receiver, std::move(callback), nullptr, QSize()}, priority);
+}
+
+void
+MediaScheduler::fetchImage(const QUrl &url,
+                           QObject *receiver,
+                           const QSize &size,
+                           ImageCallback callback,
+                           Priority priority)
+{
+        if (!receiver || url.isEmpty())
+                return;
+
+        enqueue(url, Waiter{receiver, receiver, nullptr, std::move(callback), size}, priority);
+}
+
+void
+MediaScheduler::enqueue(const QUrl &url, Waiter waiter, Priority priority)
+{
+        const auto key      = url.toString();
+        const auto receiver = waiter.id;
+        auto &request       = requests_[key];
+
+        if (request.url.isEmpty()) {
+                request.url      = url;
+                request.priority = priority;
+                request.sequence = sequence_++;
+        } else {
+                request.priority = std::max(request.priority, priority);
+        }
+
+        waiter.destroyed = connect(receiver, &QObject::destroyed, this, [this, key](QObject *obj) {
+                removeWaiter(key, obj);
+        });
+
+        request.waiters.push_back(std::move(waiter));
+
+        dispatch();
+}
+
+void
+MediaScheduler::prioritize(const QUrl &url, Priority priority)
+{
+        auto it = requests_.find(url.toString());
+
+        if (it == requests_.end())
+                return;
+
+        it->second.priority = std::max(it->second.priority, priority);
+}
+
+void
+MediaScheduler::holdBack(bool hold)
+{
+        if (heldBack_ == hold)
+                return;
+
+        heldBack_ = hold;
+
+        if (!heldBack_)
+                dispatch();
+}
+
+void
+MediaScheduler::dispatch()
+{
+        // The media repository keeps failing, give it some time to recover.
+        if (retry_.isOpen()) {
+                if (!dispatchScheduled_) {
+                        dispatchScheduled_ = true;
+
+                        QTimer::singleShot(retry_.remaining(), this, [this]() {
+                                dispatchScheduled_ = false;
+                                dispatch();
+                        });
+                }
+
+                return;
+        }
+
+        const int limit = heldBack_ ? MAX_HELD_BACK_DOWNLOADS : MAX_ACTIVE_DOWNLOADS;
+
+        while (active_ < limit) {
+                auto next = requests_.end();
+
+                for (auto it = requests_.begin(); it != requests_.end(); ++it) {
+                        if (it->second.reply != nullptr || it->second.delayed)
+                                continue;
+
+                        if (heldBack_ && it->second.priority == Priority::Background)
+                                continue;
+
+                        if (next == requests_.end() ||
+                            it->second.priority > next->second.priority ||
+                            (it->second.priority == next->second.priority &&
+                             it->second.sequence < next->second.sequence))
+                                next = it;
+                }
+
+                if (next == requests_.end())
+                        return;
+
+                start(next->first, next->second);
+        }
+}
+
+void
+MediaScheduler::start(const QString &key, Request &request)
+{
+        active_ += 1;
+
+        request.reply = manager_->get(QNetworkRequest(request.url));
+
+        auto reply = request.reply;
+        connect(reply, &QNetworkReply::finished, this, [this, key, reply]() {
+                finished(key, reply);
+        });
+}
+
+void
+MediaScheduler::finished(const QString &key, QNetworkReply *reply)
+{
+        reply->deleteLater();
+        active_ -= 1;
+
+        auto it = requests_.find(key);
+
+        // The request was cancelled.
+        if (it == requests_.end() || it->second.reply != reply) {
+                dispatch();
+                return;
+        }
+
+        int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+
+        if (status == 0 || status >= 400) {
+                qWarning() << reply->errorString() << key;
+
+                if (RetryPolicy::isTransient(reply) && it->second.failures < MAX_RETRIES) {
+                        retry(key, it->second, reply);
+                } else {
+                        release(it->second.waiters);
+                        requests_.erase(it);
+                }
+
+                dispatch();
+                return;
+        }
+
+        retry_.succeeded();
+
+        auto waiters = std::move(it->second.waiters);
+        requests_.erase(it);
+
+        release(waiters);
+
+        const auto data = reply->readAll();
+
+        // Start the next download before the (potentially expensive) callbacks run.
+        dispatch();
+
+        if (data.isEmpty()) {
+                qWarning() << "received media with no data:" << key;
+                return;
+        }
+
+        std::map<std::pair<int, int>, std::vector<Waiter>> decodes;
+
+        for (auto &waiter : waiters) {
+                if (!waiter.receiver)
+                        continue;
+
+                if (waiter.callback) {
+                        waiter.callback(data);
+                        continue;
+                }
+
+                const auto size = waiter.size;
+                decodes[{size.width(), size.height()}].push_back(std::move(waiter));
+        }
+
+        for (auto &group : decodes) {
+                const auto size = group.second.front().size;
+                decode(data, size, std::move(group.second));
+        }
+}
+
+void
+MediaScheduler::retry(const QString &key, Request &request, QNetworkReply *reply)
+{
+        request.reply   = nullptr;
+        request.delayed = true;
+        request.failures += 1;
+
+        QTimer::singleShot(retry_.failed(reply, reply->readAll()), this, [this, key]() {
+                auto it = requests_.find(key);
+
+                // Nobody is interested anymore.
+                if (it == requests_.end())
+                        return;
+
+                it->second.delayed = false;
+                dispatch();
+        });
+}
+
+void
+MediaScheduler::decode(const QByteArray &data, const QSize &size, std::vector<Waiter> waiters)
+{
+        auto watcher = new QFutureWatcher<QImage>(this);
+
+        connect(watcher, &QFutureWatcher<QImage>::finished, this, [watcher, waiters, data]() {
+                watcher->deleteLater();
+
+                const auto img = watcher->result();
+
+                if (img.isNull())
+                        return;
+
+                for (const auto &waiter : waiters) {
+                        if (waiter.receiver)
+                                waiter.imageCallback(img, data);
+                }
+        });
+
+        watcher->setFuture(QtConcurrent::run(decodeImage, data, size));
+}
+
+void
+MediaScheduler::removeWaiter(const QString &key, const QObject *receiver)
+{
+        auto it = requests_.find(key);
+
+        if (it == requests_.end())
+                return;
+
+        auto &waiters = it->second.waiters;
+        auto removed  = std::stable_partition(
+          waiters.begin(), waiters.end(), [receiver](const Waiter &waiter) {
+                  return waiter.id != receiver && waiter.receiver;
+          });
+
+        for (auto waiter = removed; waiter != waiters.end(); ++waiter)
+                disconnect(waiter->destroyed);
+
+        waiters.erase(removed, waiters.end());
+
+        if (!waiters.empty())
+                return;
+
+        // Nobody is interested anymore.
+        auto reply = it->second.reply;
+        requests_.erase(it);
+
+        if (reply)
+                reply->abort();
+}
+
+void
+MediaScheduler::release(const std::vector<Waiter> &waiters)
+{
+        for (const auto &waiter : waiters)
+                disconnect(waiter.destroyed);
+}
@@ -0,0 +1,127 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <algorithm>
+#include <random>
+
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+
+#include "RetryPolicy.h"
+
+namespace {
+//! Caps the exponent, so the delay can't overflow.
+constexpr int MAX_EXPONENT = 20;
+
+qint64
+randomDelay(qint64 min, qint64 max)
+{
+        static thread_local std::mt19937 engine{std::random_device{}()};
+
+        return std::uniform_int_distribution<qint64>{min, max}(engine);
+}
+}
+
+RetryPolicy::RetryPolicy(int baseDelay, int maxDelay, int failureThreshold, int openDuration)
+  : baseDelay_{baseDelay}
+  , maxDelay_{maxDelay}
+  , failureThreshold_{failureThreshold}
+  , openDuration_{openDuration}
+{}
+
+int
+RetryPolicy::failed(int serverDelay)
+{
+        failures_ += 1;
+
+        const auto exponent = std::min(failures_ - 1, MAX_EXPONENT);
+        const auto ceiling  = std::min<qint64>(maxDelay_, qint64(baseDelay_) << exponent);
+
+        qint64 delay = serverDelay >= 0 ? serverDelay : randomDelay(0, ceiling);
+
+        if (failures_ >= failureThreshold_) {
+                // The open period is jittered as well, so the clients don't come back together.
+                const auto now = QDateTime::currentMSecsSinceEpoch();
+                openUntil_     = now + randomDelay(openDuration_ / 2, openDuration_);
+
+                delay = std::max(delay, openUntil_ - now);
+        }
+
+        return static_cast<int>(delay);
+}
+
+int
+RetryPolicy::failed(QNetworkReply *reply, const QByteArray &body)
+{
+        return failed(serverDelay(reply, body));
+}
+
+void
+RetryPolicy::succeeded()
+{
+        failures_  = 0;
+        openUntil_ = 0;
+}
+
+bool
+RetryPolicy::isOpen() const
+{
+        return remaining() > 0;
+}
+
+int
+RetryPolicy::remaining() const
+{
+        if (failures_ < failureThreshold_)
+                return 0;
+
+        return static_cast<int>(
+          std::max<qint64>(0, openUntil_ - QDateTime::currentMSecsSinceEpoch()));
+}
+
+int
+RetryPolicy::serverDelay(QNetworkReply *reply, const QByteArray &body)
+{
+        // Homeservers only send the delay-seconds form of the header.
+        if (reply->hasRawHeader("Retry-After")) {
+                bool ok            = false;
+                const auto seconds = reply->rawHeader("Retry-After").trimmed().toInt(&ok);
+
+                if (ok && seconds >= 0)
+                        return seconds * 1000;
+        }
+
+        const auto error = QJsonDocument::fromJson(body).object();
+
+        if (error.value("errcode").toString() == "M_LIMIT_EXCEEDED" &&
+            error.contains("retry_after_ms"))
+                return std::max(0, error.value("retry_after_ms").toInt());
+
+        return -1;
+}
+
+bool
+RetryPolicy::isTransient(QNetworkReply *reply)
+{
+        const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+
+        return status == 0 || status == 429 || status >= 500;
+}
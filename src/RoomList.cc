@@ -63,7 +63,8 @@ RoomList::RoomList(QSharedPointer<UserSettings> userSettings, QWidget *parent)
                        const QString &url,
                        const QByteArray &data) {
                         if (cache::client())
-                                cache::client()->saveImage(url, data);
+                                cache::client()->saveImage(
+                                  AvatarProvider::cacheKey(url, AvatarTier::List), data);
 
                         updateRoomAvatar(room_id, img);
                 });
@@ -98,10 +99,11 @@ RoomList::updateAvatar(const QString &room_id, const QString &url)
         QByteArray savedImgData;
 
         if (cache::client())
-                savedImgData = cache::client()->image(url);
+                savedImgData =
+                  cache::client()->image(AvatarProvider::cacheKey(url, AvatarTier::List));
 
         if (savedImgData.isEmpty()) {
-                http::client()->fetchRoomAvatar(room_id, url);
+                http::client()->fetchRoomAvatar(room_id, url, AvatarTier::List);
         } else {
                 QPixmap img;
                 img.loadFromData(savedImgData);
@@ -83,7 +83,10 @@ void
 UserItem::resolveAvatar(const QString &user_id)
 {
         AvatarProvider::resolve(
-          ChatPage::instance()->currentRoom(), userId_, this, [this, user_id](const QImage &img) {
+          ChatPage::instance()->currentRoom(),
+          userId_,
+          this,
+          [this, user_id](const QImage &img) {
                   // The user on the widget when the avatar is resolved,
                   // might be different from the user that made the call.
                   if (user_id == userId_)
@@ -91,7 +94,8 @@ UserItem::resolveAvatar(const QString &user_id)
                   else
                           // We try to resolve the avatar again.
                           resolveAvatar(userId_);
-          });
+          },
+          AvatarTier::Small);
 }
 
 void
@@ -0,0 +1,291 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <QtConcurrent>
+
+#include "SyncParser.h"
+
+using namespace syncparser;
+
+namespace {
+
+[[noreturn]] void
+malformed()
+{
+        throw std::invalid_argument("malformed /sync response");
+}
+
+bool
+isWhitespace(char c)
+{
+        return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+const char *
+skipWhitespace(const char *pos, const char *end)
+{
+        while (pos != end && isWhitespace(*pos))
+                ++pos;
+
+        return pos;
+}
+
+//! Returns the position right after the closing quote of the string starting at `pos`.
+const char *
+skipString(const char *pos, const char *end)
+{
+        if (pos == end || *pos != '"')
+                malformed();
+
+        ++pos;
+
+        while (pos != end) {
+                if (*pos == '\\') {
+                        if (end - pos < 2)
+                                malformed();
+
+                        pos += 2;
+                        continue;
+                }
+
+                if (*pos == '"')
+                        return pos + 1;
+
+                ++pos;
+        }
+
+        malformed();
+}
+
+//! Returns the position right after the value starting at `pos`.
+const char *
+skipValue(const char *pos, const char *end)
+{
+        pos = skipWhitespace(pos, end);
+
+        if (pos == end)
+                malformed();
+
+        if (*pos == '"')
+                return skipString(pos, end);
+
+        if (*pos == '{' || *pos == '[') {
+                int depth = 0;
+
+                while (pos != end) {
+                        switch (*pos) {
+                        case '"':
+                                pos = skipString(pos, end);
+                                continue;
+                        case '{':
+                        case '[':
+                                ++depth;
+                                break;
+                        case '}':
+                        case ']':
+                                if (--depth == 0)
+                                        return pos + 1;
+                                break;
+                        default:
+                                break;
+                        }
+
+                        ++pos;
+                }
+
+                malformed();
+        }
+
+        // Numbers & literals.
+        while (pos != end && *pos != ',' && *pos != '}' && *pos != ']' && !isWhitespace(*pos))
+                ++pos;
+
+        return pos;
+}
+
+bool
+isObject(const char *pos, const char *end)
+{
+        pos = skipWhitespace(pos, end);
+        return pos != end && *pos == '{';
+}
+
+std::string
+decodeKey(const char *begin, const char *end)
+{
+        // Matrix identifiers hardly ever need escaping.
+        if (std::find(begin, end, '\\') == end)
+                return std::string(begin + 1, end - 1);
+
+        return json::parse(begin, end).get<std::string>();
+}
+
+//! Invoke the callback with the key and the value range of every member of an object.
+template<class Callback>
+void
+forEachMember(const char *pos, const char *end, Callback callback)
+{
+        pos = skipWhitespace(pos, end);
+
+        if (pos == end || *pos != '{')
+                malformed();
+
+        pos = skipWhitespace(pos + 1, end);
+
+        if (pos != end && *pos == '}')
+                return;
+
+        while (true) {
+                const char *keyEnd = skipString(pos, end);
+                const auto key     = decodeKey(pos, keyEnd);
+
+                pos = skipWhitespace(keyEnd, end);
+
+                if (pos == end || *pos != ':')
+                        malformed();
+
+                const char *valueBegin = skipWhitespace(pos + 1, end);
+                const char *valueEnd   = skipValue(valueBegin, end);
+
+                callback(key, valueBegin, valueEnd);
+
+                pos = skipWhitespace(valueEnd, end);
+
+                if (pos == end)
+                        malformed();
+
+                if (*pos == '}')
+                        return;
+
+                if (*pos != ',')
+                        malformed();
+
+                pos = skipWhitespace(pos + 1, end);
+        }
+}
+}
+
+ScanResult
+syncparser::scan(const QByteArray &data)
+{
+        ScanResult result;
+        result.rest = json::object();
+
+        const char *begin = data.constData();
+        const char *end   = begin + data.size();
+
+        auto addRooms = [&result](Section section, const char *begin, const char *end) {
+                if (!isObject(begin, end))
+                        return;
+
+                forEachMember(begin, end, [&result, section](const std::string &room_id,
+                                                             const char *room_begin,
+                                                             const char *room_end) {
+                        result.rooms.push_back(RoomSlice{section, room_id, room_begin, room_end});
+                });
+        };
+
+        auto addSections = [&addRooms](const std::string &name, const char *begin, const char *end) {
+                if (name == "join")
+                        addRooms(Section::Join, begin, end);
+                else if (name == "invite")
+                        addRooms(Section::Invite, begin, end);
+                else if (name == "leave")
+                        addRooms(Section::Leave, begin, end);
+        };
+
+        forEachMember(begin, end, [&](const std::string &key, const char *vbegin, const char *vend) {
+                if (key != "rooms") {
+                        result.rest[key] = json::parse(vbegin, vend);
+                        return;
+                }
+
+                if (isObject(vbegin, vend))
+                        forEachMember(vbegin, vend, addSections);
+        });
+
+        // The rooms are deserialized separately.
+        result.rest["rooms"] = json{
+          {"join", json::object()}, {"invite", json::object()}, {"leave", json::object()}};
+
+        return result;
+}
+
+mtx::responses::Sync
+syncparser::parse(const QByteArray &data)
+{
+        struct DecodedRoom
+        {
+                const RoomSlice *slice;
+                mtx::responses::JoinedRoom join;
+                mtx::responses::InvitedRoom invite;
+                mtx::responses::LeftRoom leave;
+                std::string error;
+        };
+
+        auto scanned = scan(data);
+
+        mtx::responses::Sync res = scanned.rest;
+
+        std::vector<DecodedRoom> decoded(scanned.rooms.size());
+        for (std::size_t i = 0; i < scanned.rooms.size(); ++i)
+                decoded[i].slice = &scanned.rooms[i];
+
+        // The rooms are independent of each other, so they're decoded concurrently.
+        // Each room is only materialized into JSON for the duration of its conversion.
+        QtConcurrent::blockingMap(decoded, [](DecodedRoom &room) {
+                try {
+                        const auto payload = json::parse(room.slice->begin, room.slice->end);
+
+                        switch (room.slice->section) {
+                        case Section::Join:
+                                room.join = payload.get<mtx::responses::JoinedRoom>();
+                                break;
+                        case Section::Invite:
+                                room.invite = payload.get<mtx::responses::InvitedRoom>();
+                                break;
+                        case Section::Leave:
+                                room.leave = payload.get<mtx::responses::LeftRoom>();
+                                break;
+                        }
+                } catch (const std::exception &e) {
+                        room.error = e.what();
+                }
+        });
+
+        for (auto &room : decoded) {
+                if (!room.error.empty())
+                        throw std::invalid_argument(room.slice->room_id + ": " + room.error);
+
+                switch (room.slice->section) {
+                case Section::Join:
+                        res.rooms.join.emplace(room.slice->room_id, std::move(room.join));
+                        break;
+                case Section::Invite:
+                        res.rooms.invite.emplace(room.slice->room_id, std::move(room.invite));
+                        break;
+                case Section::Leave:
+                        res.rooms.leave.emplace(room.slice->room_id, std::move(room.leave));
+                        break;
+                }
+        }
+
+        return res;
+}
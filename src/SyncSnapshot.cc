@@ -0,0 +1,110 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <atomic>
+#include <set>
+
+#include <QDebug>
+#include <QMutex>
+
+#include "SyncSnapshot.h"
+
+namespace {
+std::atomic<uint64_t> copies{0};
+
+#ifndef QT_NO_DEBUG
+QMutex sharedMutex;
+//! Addresses of the rooms owned by the live snapshots.
+std::set<const void *> shared;
+
+void
+track(const mtx::responses::Sync *res, bool alive)
+{
+        QMutexLocker lock(&sharedMutex);
+
+        auto update = [alive](const void *ptr) {
+                if (alive)
+                        shared.insert(ptr);
+                else
+                        shared.erase(ptr);
+        };
+
+        update(&res->rooms);
+
+        for (const auto &room : res->rooms.join)
+                update(&room.second);
+}
+
+void
+check(const void *ptr, const char *consumer)
+{
+        {
+                QMutexLocker lock(&sharedMutex);
+
+                if (shared.count(ptr) != 0)
+                        return;
+        }
+
+        const auto total = ++copies;
+        qWarning() << consumer << "received a copy of the sync rooms, copies so far:" << total;
+}
+#endif
+}
+
+SyncSnapshot
+snapshot::create(mtx::responses::Sync &&res)
+{
+#ifdef QT_NO_DEBUG
+        return SyncSnapshot(new mtx::responses::Sync(std::move(res)));
+#else
+        auto sync = new mtx::responses::Sync(std::move(res));
+        track(sync, true);
+
+        return SyncSnapshot(sync, [](const mtx::responses::Sync *res) {
+                track(res, false);
+                delete res;
+        });
+#endif
+}
+
+void
+snapshot::checkShared(const mtx::responses::Rooms &rooms, const char *consumer)
+{
+#ifdef QT_NO_DEBUG
+        Q_UNUSED(rooms);
+        Q_UNUSED(consumer);
+#else
+        check(&rooms, consumer);
+#endif
+}
+
+void
+snapshot::checkShared(const mtx::responses::JoinedRoom &room, const char *consumer)
+{
+#ifdef QT_NO_DEBUG
+        Q_UNUSED(room);
+        Q_UNUSED(consumer);
+#else
+        check(&room, consumer);
+#endif
+}
+
+uint64_t
+snapshot::roomCopies()
+{
+        return copies;
+}
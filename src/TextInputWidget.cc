@@ -17,7 +17,6 @@
 
 #include <QAbstractTextDocumentLayout>
 #include <QApplication>
-#include <QBuffer>
 #include <QClipboard>
 #include <QDebug>
 #include <QFileDialog>
@@ -384,21 +383,20 @@ FilteredTextEdit::textChanged()
 }
 
 void
-FilteredTextEdit::uploadData(const QByteArray data, const QString &media, const QString &filename)
+FilteredTextEdit::uploadData(const QSharedPointer<QIODevice> data,
+                             const QString &media,
+                             const QString &filename)
 {
-        QSharedPointer<QBuffer> buffer{new QBuffer{this}};
-        buffer->setData(data);
-
         emit startedUpload();
 
         if (media == "image")
-                emit image(buffer, filename);
+                emit image(data, filename);
         else if (media == "audio")
-                emit audio(buffer, filename);
+                emit audio(data, filename);
         else if (media == "video")
-                emit video(buffer, filename);
+                emit video(data, filename);
         else
-                emit file(buffer, filename);
+                emit file(data, filename);
 }
 
 void
@@ -433,11 +431,17 @@ TextInputWidget::TextInputWidget(QWidget *parent)
         spinner_->setFixedHeight(InputHeight);
         spinner_->setFixedWidth(InputHeight);
         spinner_->setObjectName("FileUploadSpinner");
+        spinner_->setCursor(Qt::PointingHandCursor);
         spinner_->hide();
 
         QFont font;
         font.setPixelSize(conf::textInputFontSize);
 
+        uploadProgress_ = new QLabel(this);
+        uploadProgress_->setObjectName("FileUploadProgress");
+        uploadProgress_->setFont(font);
+        uploadProgress_->hide();
+
         input_ = new FilteredTextEdit(this);
         input_->setFixedHeight(InputHeight);
         input_->setFont(font);
@@ -456,6 +460,8 @@ TextInputWidget::TextInputWidget(QWidget *parent)
                 if (q.isEmpty() || !cache::client())
                         return;
 
+                ChatPage::instance()->loadRoomMembers(ChatPage::instance()->currentRoom());
+
                 QtConcurrent::run([this, q = q.toLower().toStdString()]() {
                         try {
                                 emit input_->resultsRetrieved(cache::client()->searchUsers(
@@ -506,6 +512,7 @@ TextInputWidget::TextInputWidget(QWidget *parent)
 
         connect(
           input_, &FilteredTextEdit::startedUpload, this, &TextInputWidget::showUploadSpinner);
+        connect(spinner_, &LoadingIndicator::clicked, this, &TextInputWidget::cancelUpload);
 }
 
 void
@@ -580,18 +587,38 @@ TextInputWidget::showUploadSpinner()
         sendFileBtn_->hide();
 
         topLayout_->insertWidget(0, spinner_);
+        spinner_->setToolTip(tr("Uploading... Click to cancel."));
         spinner_->start();
+
+        // Filled in once the first progress update arrives.
+        uploadProgress_->clear();
+        topLayout_->insertWidget(1, uploadProgress_);
+        uploadProgress_->show();
 }
 
 void
 TextInputWidget::hideUploadSpinner()
 {
         topLayout_->removeWidget(spinner_);
+        topLayout_->removeWidget(uploadProgress_);
+        uploadProgress_->hide();
+
         topLayout_->insertWidget(0, sendFileBtn_);
         sendFileBtn_->show();
         spinner_->stop();
 }
 
+void
+TextInputWidget::showUploadProgress(qint64 sent, qint64 total)
+{
+        spinner_->setToolTip(
+          tr("Uploading %1. Click to cancel.").arg(utils::transferProgress(sent, total)));
+
+        // The size of the upload isn't always known.
+        if (total > 0)
+                uploadProgress_->setText(QString("%1%").arg(sent * 100 / total));
+}
+
 void
 TextInputWidget::stopTyping()
 {
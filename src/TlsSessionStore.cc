@@ -0,0 +1,178 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QSaveFile>
+#include <QSslConfiguration>
+
+#include "TlsSessionStore.h"
+
+//! Lifetime of the tickets that don't come with a hint (in seconds).
+constexpr int DEFAULT_TICKET_LIFETIME = 60 * 60;
+//! RFC 8446 doesn't allow the tickets to be used for longer than a week (in seconds).
+constexpr int MAX_TICKET_LIFETIME = 7 * 24 * 60 * 60;
+
+TlsSessionStore::TlsSessionStore(const QString &path)
+  : path_{path}
+{
+        load();
+}
+
+void
+TlsSessionStore::apply(QNetworkRequest &request) const
+{
+        if (request.url().scheme() != "https")
+                return;
+
+        request.setSslConfiguration(configuration(request.url().host()));
+}
+
+QSslConfiguration
+TlsSessionStore::configuration(const QString &host) const
+{
+        auto config = QSslConfiguration::defaultConfiguration();
+        config.setSslOption(QSsl::SslOptionDisableSessionTickets, false);
+        config.setSslOption(QSsl::SslOptionDisableSessionPersistence, false);
+
+        if (isValid(host))
+                config.setSessionTicket(ticket_);
+
+        return config;
+}
+
+void
+TlsSessionStore::track(QNetworkReply *reply)
+{
+        if (reply->url().scheme() != "https")
+                return;
+
+        // The ticket might only be issued after the handshake (e.g TLS 1.3).
+        QObject::connect(reply, &QNetworkReply::finished, reply, [this, reply]() {
+                const auto config = reply->sslConfiguration();
+                const auto ticket = config.sessionTicket();
+                const auto host   = reply->url().host();
+
+                if (ticket.isEmpty() || (host == host_ && ticket == ticket_))
+                        return;
+
+                update(host, ticket, config.sessionTicketLifeTimeHint());
+
+                // Every connection gets its own tickets. Only the first one is written
+                // right away, the rest is saved on flush.
+                if (host != savedHost_ || QDateTime::currentMSecsSinceEpoch() >= savedExpires_)
+                        save();
+        });
+}
+
+void
+TlsSessionStore::flush()
+{
+        if (dirty_)
+                save();
+}
+
+void
+TlsSessionStore::clear()
+{
+        host_.clear();
+        ticket_.clear();
+        expires_ = 0;
+
+        savedHost_.clear();
+        savedExpires_ = 0;
+        dirty_        = false;
+
+        QFile::remove(path_);
+}
+
+void
+TlsSessionStore::load()
+{
+        QFile file(path_);
+
+        if (!file.open(QIODevice::ReadOnly))
+                return;
+
+        const auto obj = QJsonDocument::fromJson(file.readAll()).object();
+
+        host_    = obj["host"].toString();
+        ticket_  = QByteArray::fromBase64(obj["ticket"].toString().toLatin1());
+        expires_ = static_cast<qint64>(obj["expires"].toDouble());
+
+        savedHost_    = host_;
+        savedExpires_ = expires_;
+}
+
+void
+TlsSessionStore::update(const QString &host, const QByteArray &ticket, int lifetimeHint)
+{
+        if (lifetimeHint <= 0)
+                lifetimeHint = DEFAULT_TICKET_LIFETIME;
+
+        host_    = host;
+        ticket_  = ticket;
+        expires_ = QDateTime::currentMSecsSinceEpoch() +
+                   qMin(lifetimeHint, MAX_TICKET_LIFETIME) * qint64(1000);
+        dirty_   = true;
+}
+
+void
+TlsSessionStore::save()
+{
+        dirty_ = false;
+
+        QJsonObject obj{{"host", host_},
+                        {"ticket", QString::fromLatin1(ticket_.toBase64())},
+                        {"expires", static_cast<double>(expires_)}};
+
+        // The ticket grants access to the session keys, so it's kept private to the user.
+        QDir().mkpath(QFileInfo(path_).absolutePath());
+
+        QSaveFile file(path_);
+
+        if (!file.open(QIODevice::WriteOnly)) {
+                qWarning() << "failed to save the TLS session:" << file.errorString();
+                return;
+        }
+
+        file.setPermissions(QFileDevice::ReadOwner | QFileDevice::WriteOwner);
+        file.write(QJsonDocument(obj).toJson(QJsonDocument::Compact));
+
+        if (!file.commit()) {
+                qWarning() << "failed to save the TLS session:" << file.errorString();
+                return;
+        }
+
+        savedHost_    = host_;
+        savedExpires_ = expires_;
+}
+
+bool
+TlsSessionStore::isValid(const QString &host) const
+{
+        return !ticket_.isEmpty() && host == host_ &&
+               QDateTime::currentMSecsSinceEpoch() < expires_;
+}
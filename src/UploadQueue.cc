@@ -0,0 +1,287 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <algorithm>
+
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QFutureWatcher>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QtConcurrent>
+
+#include "Cache.h"
+#include "UploadQueue.h"
+
+//! Maximum number of concurrent uploads.
+constexpr int MAX_ACTIVE_UPLOADS = 3;
+
+namespace {
+QByteArray
+contentHash(QSharedPointer<QIODevice> data)
+{
+        // The content of pipes & sockets can't be read twice.
+        if (data->isSequential() || !data->open(QIODevice::ReadOnly))
+                return QByteArray();
+
+        QCryptographicHash hash(QCryptographicHash::Sha256);
+        const bool ok = hash.addData(data.data());
+
+        data->close();
+
+        return ok ? hash.result() : QByteArray();
+}
+}
+
+UploadQueue::UploadQueue(Sender sender, QObject *parent)
+  : QObject(parent)
+  , sender_{std::move(sender)}
+{}
+
+void
+UploadQueue::enqueue(const QString &roomid, QSharedPointer<QIODevice> data, Callback callback)
+{
+        const auto id = sequence_++;
+
+        Job job;
+        job.roomid   = roomid;
+        job.data     = data;
+        job.callback = std::move(callback);
+
+        jobs_.emplace(id, std::move(job));
+
+        // Hashing reads the whole content, so it's kept off the GUI thread.
+        auto watcher = new QFutureWatcher<QByteArray>(this);
+        connect(watcher, &QFutureWatcher<QByteArray>::finished, this, [this, watcher, id]() {
+                watcher->deleteLater();
+                hashed(id, watcher->result());
+        });
+        watcher->setFuture(QtConcurrent::run(contentHash, data));
+}
+
+void
+UploadQueue::hashed(quint64 id, const QByteArray &hash)
+{
+        auto it = jobs_.find(id);
+
+        // The upload was canceled.
+        if (it == jobs_.end())
+                return;
+
+        auto &job = it->second;
+        job.hash  = hash;
+
+        const auto media = cache::client()->uploadedMedia(hash);
+
+        if (!media.url.empty()) {
+                job.url   = QString::fromStdString(media.url);
+                job.mime  = QString::fromStdString(media.mimetype);
+                job.size  = media.size;
+                job.state = State::Done;
+
+                deliver(job.roomid);
+                return;
+        }
+
+        job.state = State::Pending;
+        dispatch();
+}
+
+void
+UploadQueue::dispatch()
+{
+        while (active_ < MAX_ACTIVE_UPLOADS) {
+                auto next = std::find_if(jobs_.begin(), jobs_.end(), [](const auto &job) {
+                        return job.second.state == State::Pending;
+                });
+
+                if (next == jobs_.end())
+                        return;
+
+                start(next->first, next->second);
+        }
+}
+
+void
+UploadQueue::start(quint64 id, Job &job)
+{
+        auto reply = sender_(job.data);
+
+        if (reply == nullptr) {
+                fail(id, 0, "Media upload failed - Unable to read the file");
+                return;
+        }
+
+        active_ += 1;
+
+        job.state = State::Active;
+        job.reply = reply;
+
+        connect(reply, &QNetworkReply::uploadProgress, this, [this, id](qint64 sent, qint64 total) {
+                auto it = jobs_.find(id);
+                if (it == jobs_.end())
+                        return;
+
+                it->second.sent  = sent;
+                it->second.total = total;
+
+                updateProgress();
+        });
+        connect(reply, &QNetworkReply::finished, this, [this, id, reply]() {
+                finished(id, reply);
+        });
+}
+
+void
+UploadQueue::finished(quint64 id, QNetworkReply *reply)
+{
+        reply->deleteLater();
+        active_ -= 1;
+
+        auto it = jobs_.find(id);
+
+        // The upload was canceled.
+        if (it == jobs_.end() || it->second.reply != reply) {
+                dispatch();
+                return;
+        }
+
+        int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+
+        if (status == 0 || status >= 400) {
+                fail(id, status, QString("Media upload failed - %1").arg(reply->errorString()));
+                dispatch();
+                return;
+        }
+
+        auto res_data = reply->readAll();
+
+        if (res_data.isEmpty()) {
+                fail(id, status, "Media upload failed - Empty response");
+                dispatch();
+                return;
+        }
+
+        auto json = QJsonDocument::fromJson(res_data);
+
+        if (!json.isObject()) {
+                fail(id, status, "Media upload failed - Invalid response");
+                dispatch();
+                return;
+        }
+
+        auto object = json.object();
+        if (!object.contains("content_uri")) {
+                fail(id, status, "Media upload failed - Missing 'content_uri'");
+                dispatch();
+                return;
+        }
+
+        auto &job = it->second;
+        job.url   = object.value("content_uri").toString();
+        job.mime  = reply->request().header(QNetworkRequest::ContentTypeHeader).toString();
+        job.size  = reply->request().header(QNetworkRequest::ContentLengthHeader).toLongLong();
+        job.reply = nullptr;
+        job.state = State::Done;
+
+        if (!job.hash.isEmpty()) {
+                UploadedMedia media;
+                media.url      = job.url.toStdString();
+                media.mimetype = job.mime.toStdString();
+                media.size     = job.size;
+
+                cache::client()->saveUploadedMedia(job.hash, media);
+        }
+
+        const auto roomid = job.roomid;
+
+        // Start the next upload before the messages are sent.
+        dispatch();
+        deliver(roomid);
+}
+
+void
+UploadQueue::fail(quint64 id, int statusCode, const QString &msg)
+{
+        auto it = jobs_.find(id);
+        if (it == jobs_.end())
+                return;
+
+        const auto roomid = it->second.roomid;
+        jobs_.erase(it);
+
+        emit failed(statusCode, msg);
+
+        // The uploads that were waiting for this one can be delivered now.
+        deliver(roomid);
+}
+
+void
+UploadQueue::deliver(const QString &roomid)
+{
+        while (true) {
+                auto it = std::find_if(jobs_.begin(), jobs_.end(), [&roomid](const auto &job) {
+                        return job.second.roomid == roomid;
+                });
+
+                if (it == jobs_.end() || it->second.state != State::Done)
+                        return;
+
+                auto job = std::move(it->second);
+                jobs_.erase(it);
+
+                job.callback(job.url, job.mime, job.size);
+        }
+}
+
+void
+UploadQueue::updateProgress()
+{
+        qint64 sent  = 0;
+        qint64 total = 0;
+
+        for (const auto &job : jobs_) {
+                if (job.second.state != State::Active)
+                        continue;
+
+                sent += job.second.sent;
+                total += job.second.total;
+        }
+
+        emit progress(sent, total);
+}
+
+void
+UploadQueue::cancel()
+{
+        if (jobs_.empty())
+                return;
+
+        // Aborting finishes the replies, which must not find their jobs anymore.
+        auto jobs = std::move(jobs_);
+        jobs_.clear();
+
+        for (auto &job : jobs) {
+                if (job.second.reply)
+                        job.second.reply->abort();
+        }
+
+        emit canceled();
+}
@@ -87,6 +87,17 @@ utils::humanReadableFileSize(uint64_t bytes)
         return QString::number(size, 'g', 4) + ' ' + units[u];
 }
 
+QString
+utils::transferProgress(qint64 transferred, qint64 total)
+{
+        if (total < 0)
+                return humanReadableFileSize(transferred);
+
+        return QString("%1 / %2")
+          .arg(humanReadableFileSize(transferred))
+          .arg(humanReadableFileSize(total));
+}
+
 int
 utils::levenshtein_distance(const std::string &s1, const std::string &s2)
 {
@@ -152,3 +163,20 @@ utils::scaleImageToPixmap(const QImage &img, int size)
         return QPixmap::fromImage(
           img.scaled(sz, sz, Qt::IgnoreAspectRatio, Qt::SmoothTransformation));
 }
+
+QSize
+utils::scaledSize(uint64_t max_width, uint64_t max_height, const QSize &source)
+{
+        if (source.isEmpty())
+                return QSize();
+
+        auto width_ratio  = (double)max_width / (double)source.width();
+        auto height_ratio = (double)max_height / (double)source.height();
+
+        auto min_aspect_ratio = std::min(width_ratio, height_ratio);
+
+        if (min_aspect_ratio > 1)
+                return source;
+
+        return QSize(source.width() * min_aspect_ratio, source.height() * min_aspect_ratio);
+}
@@ -43,11 +43,33 @@ ImageOverlay::ImageOverlay(QPixmap image, QWidget *parent)
         move(QApplication::desktop()->mapToGlobal(screen_.topLeft()));
         resize(screen_.size());
 
+        scaleImage();
+
         connect(this, SIGNAL(closing()), this, SLOT(close()));
 
         raise();
 }
 
+void
+ImageOverlay::setImage(const QPixmap &image)
+{
+        originalImage_ = image;
+
+        scaleImage();
+        update();
+}
+
+void
+ImageOverlay::scaleImage()
+{
+        int outer_margin = screen_.width() * 0.12;
+
+        int max_width  = screen_.width() - 2 * outer_margin;
+        int max_height = screen_.height();
+
+        image_ = utils::scaleDown<QPixmap>(max_width, max_height, originalImage_);
+}
+
 void
 ImageOverlay::paintEvent(QPaintEvent *event)
 {
@@ -67,8 +89,6 @@ ImageOverlay::paintEvent(QPaintEvent *event)
         int max_width  = screen_.width() - 2 * outer_margin;
         int max_height = screen_.height();
 
-        image_ = utils::scaleDown<QPixmap>(max_width, max_height, originalImage_);
-
         int diff_x = max_width - image_.width();
         int diff_y = max_height - image_.height();
 
@@ -35,7 +35,8 @@ MemberItem::MemberItem(const RoomMember &member, QWidget *parent)
                 AvatarProvider::resolve(ChatPage::instance()->currentRoom(),
                                         member.user_id,
                                         this,
-                                        [this](const QImage &img) { avatar_->setImage(img); });
+                                        [this](const QImage &img) { avatar_->setImage(img); },
+                                        AvatarTier::List);
 
         QFont nameFont, idFont;
         nameFont.setWeight(65);
@@ -106,6 +107,27 @@ MemberList::MemberList(const QString &room_id, QWidget *parent)
         } catch (const lmdb::error &e) {
                 qCritical() << e.what();
         }
+
+        // Reload the list once the members that weren't part of the sync are available.
+        connect(ChatPage::instance(),
+                &ChatPage::roomMembersLoaded,
+                this,
+                [this](const QString &room_id) {
+                        if (room_id != room_id_)
+                                return;
+
+                        // Remove everything but the button at the bottom.
+                        while (list_->count() > 1)
+                                delete list_->takeItem(0);
+
+                        try {
+                                addUsers(cache::client()->getMembers(room_id_.toStdString()));
+                        } catch (const lmdb::error &e) {
+                                qCritical() << e.what();
+                        }
+                });
+
+        ChatPage::instance()->loadRoomMembers(room_id_);
 }
 
 void
@@ -52,7 +52,7 @@ PreviewUploadOverlay::PreviewUploadOverlay(QWidget *parent)
         vlayout->addLayout(hlayout);
 
         connect(&upload_, &QPushButton::clicked, [this]() {
-                emit confirmUpload(data_, mediaType_, fileName_.text());
+                emit confirmUpload(device(), mediaType_, fileName_.text());
                 close();
         });
         connect(&cancel_, &QPushButton::clicked, this, &PreviewUploadOverlay::close);
@@ -104,7 +104,10 @@ void
 PreviewUploadOverlay::setLabels(const QString &type, const QString &mime, uint64_t upload_size)
 {
         if (mediaType_ == "image") {
-                if (!image_.loadFromData(data_)) {
+                const bool loaded =
+                  data_.isEmpty() ? image_.load(filePath_) : image_.loadFromData(data_);
+
+                if (!loaded) {
                         titleLabel_.setText(QString{tr(ERROR)}.arg(type));
                 } else {
                         titleLabel_.setText(QString{tr(DEFAULT)}.arg(mediaType_));
@@ -121,6 +124,18 @@ PreviewUploadOverlay::setLabels(const QString &type, const QString &mime, uint64
         }
 }
 
+QSharedPointer<QIODevice>
+PreviewUploadOverlay::device() const
+{
+        if (data_.isEmpty())
+                return QSharedPointer<QFile>{new QFile{filePath_}};
+
+        QSharedPointer<QBuffer> buffer{new QBuffer};
+        buffer->setData(data_);
+
+        return buffer;
+}
+
 void
 PreviewUploadOverlay::setPreview(const QByteArray data, const QString &mime)
 {
@@ -148,21 +163,23 @@ PreviewUploadOverlay::setPreview(const QString &path)
                 return;
         }
 
-        QMimeDatabase db;
-        auto mime = db.mimeTypeForFileNameAndData(path, &file);
-
-        if ((data_ = file.readAll()).isEmpty()) {
-                qWarning() << "Failed to read media:" << file.errorString();
+        if (file.size() == 0) {
+                qWarning() << "Failed to read media: empty file" << path;
                 close();
                 return;
         }
 
+        // Only the header of the file is needed to detect its type.
+        QMimeDatabase db;
+        auto mime = db.mimeTypeForFileNameAndData(path, &file);
+
         auto const &split = mime.name().split('/');
 
+        data_.clear();
         mediaType_ = split[0];
         filePath_  = file.fileName();
         isImage_   = false;
 
-        setLabels(split[1], mime.name(), data_.size());
+        setLabels(split[1], mime.name(), file.size());
         init();
 }
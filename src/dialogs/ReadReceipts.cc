@@ -58,7 +58,8 @@ ReceiptItem::ReceiptItem(QWidget *parent,
         AvatarProvider::resolve(ChatPage::instance()->currentRoom(),
                                 user_id,
                                 this,
-                                [this](const QImage &img) { avatar_->setImage(img); });
+                                [this](const QImage &img) { avatar_->setImage(img); },
+                                AvatarTier::List);
 }
 
 QString
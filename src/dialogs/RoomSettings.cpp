@@ -1,4 +1,5 @@
 #include "Avatar.h"
+#include "AvatarProvider.h"
 #include "Config.h"
 #include "FlatButton.h"
 #include "MatrixClient.h"
@@ -311,7 +312,11 @@ RoomSettings::retrieveRoomInfo()
 {
         try {
                 info_ = cache::client()->singleRoomInfo(room_id_.toStdString());
-                setAvatar(QImage::fromData(cache::client()->image(info_.avatar_url)));
+
+                // The room avatars are stored at the resolution of the room list.
+                const auto avatarKey = AvatarProvider::cacheKey(
+                  QString::fromStdString(info_.avatar_url), AvatarTier::List);
+                setAvatar(QImage::fromData(cache::client()->image(avatarKey)));
         } catch (const lmdb::error &e) {
                 qWarning() << "failed to retrieve room info from cache" << room_id_;
         }
@@ -31,6 +31,7 @@
 #include "timeline/widgets/VideoItem.h"
 
 constexpr const static char *CHECKMARK = "✓";
+constexpr const static char *FAILMARK  = "✗";
 
 constexpr int MSG_RIGHT_MARGIN = 7;
 constexpr int MSG_PADDING      = 20;
@@ -419,6 +420,14 @@ TimelineItem::markReceived()
         sendReadReceipt();
 }
 
+void
+TimelineItem::markFailed(const QString &error)
+{
+        checkmark_->setText(FAILMARK);
+        checkmark_->setAlignment(Qt::AlignTop);
+        checkmark_->setToolTip(tr("Failed to send: %1").arg(error));
+}
+
 // Only the body is displayed.
 void
 TimelineItem::generateBody(const QString &body)
@@ -149,6 +149,18 @@ TimelineView::fetchHistory()
         paginationTimer_->stop();
 }
 
+bool
+TimelineView::prefetchHistory()
+{
+        if (isPaginationInProgress_ || isTimelineFinished || prev_batch_token_.isEmpty())
+                return false;
+
+        isPaginationInProgress_ = true;
+        http::client()->messages(room_id_, prev_batch_token_);
+
+        return true;
+}
+
 void
 TimelineView::scrollDown()
 {
@@ -431,6 +443,10 @@ TimelineView::init()
                 &MatrixClient::messagesRetrieved,
                 this,
                 &TimelineView::addBackwardsEvents);
+        connect(http::client(), &MatrixClient::messagesFailed, this, [this](const QString &id) {
+                if (id == room_id_)
+                        isPaginationInProgress_ = false;
+        });
 
         connect(scroll_area_->verticalScrollBar(),
                 SIGNAL(valueChanged(int)),
@@ -515,25 +531,42 @@ TimelineView::addTimelineItem(TimelineItem *item, TimelineDirection direction)
 void
 TimelineView::updatePendingMessage(int txn_id, QString event_id)
 {
-        if (!pending_msgs_.isEmpty() &&
-            pending_msgs_.head().txn_id == txn_id) { // We haven't received it yet
-                auto msg     = pending_msgs_.dequeue();
-                msg.event_id = event_id;
+        auto it = std::find_if(pending_msgs_.begin(),
+                               pending_msgs_.end(),
+                               [txn_id](const auto &msg) { return msg.txn_id == txn_id; });
+
+        cache::client()->removeOutboxMessage(txn_id);
+
+        // We haven't received it yet.
+        if (it != pending_msgs_.end()) {
+                it->event_id = event_id;
+                it->sending  = false;
+        }
+
+        confirmPendingMessages();
+        sendNextPendingMessage();
+}
+
+void
+TimelineView::confirmPendingMessages()
+{
+        // Confirm the messages in order, so a message isn't marked as received
+        // while an earlier one is still being sent.
+        while (!pending_msgs_.isEmpty() && !pending_msgs_.head().event_id.isEmpty()) {
+                auto msg = pending_msgs_.dequeue();
 
                 if (msg.widget) {
-                        msg.widget->setEventId(event_id);
+                        msg.widget->setEventId(msg.event_id);
                         msg.widget->markReceived();
-                        eventIds_[event_id] = msg.widget;
+                        eventIds_[msg.event_id] = msg.widget;
                 }
 
                 pending_sent_msgs_.append(msg);
         }
-
-        sendNextPendingMessage();
 }
 
 void
-TimelineView::addUserMessage(mtx::events::MessageType ty, const QString &body)
+TimelineView::addUserMessage(mtx::events::MessageType ty, const QString &body, int txn_id)
 {
         auto with_sender = (lastSender_ != local_user_) || isDateDifference(lastMsgTimestamp_);
 
@@ -548,7 +581,9 @@ TimelineView::addUserMessage(mtx::events::MessageType ty, const QString &body)
 
         saveLastMessageInfo(local_user_, QDateTime::currentDateTime());
 
-        int txn_id = http::client()->incrementTransactionId();
+        if (txn_id == -1)
+                txn_id = http::client()->incrementTransactionId();
+
         PendingMessage message(ty, txn_id, body, "", "", -1, "", view_item);
         handleNewUserMessage(message);
 }
@@ -556,18 +591,44 @@ TimelineView::addUserMessage(mtx::events::MessageType ty, const QString &body)
 void
 TimelineView::handleNewUserMessage(PendingMessage msg)
 {
+        // Kept until the server confirms it, so it's sent again after a restart.
+        OutboxMessage outgoing;
+        outgoing.room_id    = room_id_.toStdString();
+        outgoing.txn_id     = msg.txn_id;
+        outgoing.type       = msg.ty;
+        outgoing.body       = msg.body.toStdString();
+        outgoing.filename   = msg.filename.toStdString();
+        outgoing.mime       = msg.mime.toStdString();
+        outgoing.media_size = msg.media_size;
+
+        cache::client()->saveOutboxMessage(outgoing);
+
         pending_msgs_.enqueue(msg);
-        if (pending_msgs_.size() == 1 && pending_sent_msgs_.isEmpty())
-                sendNextPendingMessage();
+        sendNextPendingMessage();
 }
 
 void
 TimelineView::sendNextPendingMessage()
 {
-        if (pending_msgs_.size() == 0)
+        // The messages of a room are sent one at a time, because the server may commit
+        // concurrent requests in a different order. The rooms are sent to concurrently.
+        for (auto &msg : pending_msgs_) {
+                if (msg.sending)
+                        return;
+
+                if (!msg.event_id.isEmpty())
+                        continue;
+
+                msg.sending = true;
+                sendPendingMessage(msg);
+
                 return;
+        }
+}
 
-        PendingMessage &m = pending_msgs_.head();
+void
+TimelineView::sendPendingMessage(const PendingMessage &m)
+{
         switch (m.ty) {
         case mtx::events::MessageType::Audio:
         case mtx::events::MessageType::Image:
@@ -640,19 +701,59 @@ TimelineView::removePendingMessage(const QString &txnid)
         }
         for (auto it = pending_msgs_.begin(); it != pending_msgs_.end(); ++it) {
                 if (QString::number(it->txn_id) == txnid) {
+                        cache::client()->removeOutboxMessage(it->txn_id);
+
                         int index = std::distance(pending_msgs_.begin(), it);
                         pending_msgs_.removeAt(index);
+
+                        // The messages that were waiting for the echoed
+                        // one can be confirmed & sent.
+                        confirmPendingMessages();
+                        sendNextPendingMessage();
                         return;
                 }
         }
 }
 
 void
-TimelineView::handleFailedMessage(int txnid)
+TimelineView::handleFailedMessage(int txnid, int retry_delay)
+{
+        // The rest of the queue waits for the failed message to be sent, so the
+        // messages still arrive in order.
+        QTimer::singleShot(retry_delay, this, [this, txnid]() {
+                auto it = std::find_if(pending_msgs_.cbegin(),
+                                       pending_msgs_.cend(),
+                                       [txnid](const auto &msg) { return msg.txn_id == txnid; });
+
+                // The message has been echoed in the meantime.
+                if (it == pending_msgs_.cend()) {
+                        sendNextPendingMessage();
+                        return;
+                }
+
+                sendPendingMessage(*it);
+        });
+}
+
+void
+TimelineView::handleRejectedMessage(int txnid, const QString &error)
 {
-        Q_UNUSED(txnid);
-        // Note: We do this even if the message has already been echoed.
-        QTimer::singleShot(2000, this, SLOT(sendNextPendingMessage()));
+        cache::client()->removeOutboxMessage(txnid);
+
+        auto it = std::find_if(pending_msgs_.begin(),
+                               pending_msgs_.end(),
+                               [txnid](const auto &msg) { return msg.txn_id == txnid; });
+
+        if (it != pending_msgs_.end()) {
+                if (it->widget)
+                        it->widget->markFailed(error);
+
+                pending_msgs_.erase(it);
+        }
+
+        // The messages that were waiting for it can be confirmed & sent.
+        confirmPendingMessages();
+        sendNextPendingMessage();
 }
 
 void
@@ -711,6 +812,11 @@ TimelineView::showEvent(QShowEvent *event)
 
         toggleScrollDownButton();
 
+        if (hasUnknownMembers_) {
+                hasUnknownMembers_ = false;
+                ChatPage::instance()->loadRoomMembers(room_id_);
+        }
+
         readLastEvent();
 
         QWidget::showEvent(event);
@@ -848,6 +954,20 @@ TimelineView::saveMessageInfo(const QString &sender,
                 firstMsgTimestamp_ = QDateTime::fromMSecsSinceEpoch(origin_server_ts);
 }
 
+void
+TimelineView::loadUnknownMember(const QString &sender)
+{
+        if (hasUnknownMembers_ || Cache::isMemberKnown(room_id_, sender))
+                return;
+
+        // Only the members of the opened room are retrieved. The senders that have
+        // left the room are never known, so the rest would be loaded on startup.
+        if (isVisible())
+                ChatPage::instance()->loadRoomMembers(room_id_);
+        else
+                hasUnknownMembers_ = true;
+}
+
 bool
 TimelineView::isDateDifference(const QDateTime &first, const QDateTime &second) const
 {
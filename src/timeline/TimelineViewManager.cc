@@ -20,9 +20,10 @@
 #include <QApplication>
 #include <QDebug>
 #include <QFileInfo>
-#include <QSettings>
 
+#include "Cache.h"
 #include "MatrixClient.h"
+#include "SyncSnapshot.h"
 
 #include "timeline/TimelineView.h"
 #include "timeline/TimelineViewManager.h"
@@ -31,6 +32,9 @@
 #include "timeline/widgets/ImageItem.h"
 #include "timeline/widgets/VideoItem.h"
 
+//! Number of rooms whose history is retrieved concurrently during the backfill.
+constexpr std::size_t BACKFILL_CONCURRENCY = 4;
+
 TimelineViewManager::TimelineViewManager(QWidget *parent)
   : QStackedWidget(parent)
 {
@@ -43,6 +47,10 @@ TimelineViewManager::TimelineViewManager(QWidget *parent)
                 &MatrixClient::messageSendFailed,
                 this,
                 &TimelineViewManager::messageSendFailed);
+        connect(http::client(),
+                &MatrixClient::messageSendRejected,
+                this,
+                &TimelineViewManager::messageSendRejected);
 
         connect(http::client(),
                 &MatrixClient::redactionCompleted,
@@ -53,24 +61,36 @@ TimelineViewManager::TimelineViewManager(QWidget *parent)
                         if (view)
                                 view->removeEvent(event_id);
                 });
+
+        connect(http::client(),
+                &MatrixClient::messagesRetrieved,
+                this,
+                [this](const QString &room_id, const mtx::responses::Messages &) {
+                        backfillDone(room_id);
+                });
+        connect(
+          http::client(), &MatrixClient::messagesFailed, this, &TimelineViewManager::backfillDone);
 }
 
 void
 TimelineViewManager::messageSent(const QString &event_id, const QString &roomid, int txn_id)
 {
-        // We save the latest valid transaction ID for later use.
-        QSettings settings;
-        settings.setValue("client/transaction_id", txn_id + 1);
-
         auto view = views_[roomid];
         view->updatePendingMessage(txn_id, event_id);
 }
 
 void
-TimelineViewManager::messageSendFailed(const QString &roomid, int txn_id)
+TimelineViewManager::messageSendFailed(const QString &roomid, int txn_id, int retry_delay)
 {
         auto view = views_[roomid];
-        view->handleFailedMessage(txn_id);
+        view->handleFailedMessage(txn_id, retry_delay);
+}
+
+void
+TimelineViewManager::messageSendRejected(const QString &roomid, int txn_id, const QString &error)
+{
+        auto view = views_[roomid];
+        view->handleRejectedMessage(txn_id, error);
 }
 
 void
@@ -168,6 +188,8 @@ TimelineViewManager::queueVideoMessage(const QString &roomid,
 void
 TimelineViewManager::initialize(const mtx::responses::Rooms &rooms)
 {
+        snapshot::checkShared(rooms, "TimelineViewManager");
+
         for (auto it = rooms.join.cbegin(); it != rooms.join.cend(); ++it) {
                 addRoom(it->second, QString::fromStdString(it->first));
         }
@@ -180,6 +202,87 @@ TimelineViewManager::initialize(const std::vector<std::string> &rooms)
 {
         for (const auto &roomid : rooms)
                 addRoom(QString::fromStdString(roomid));
+
+        // Before any sync is applied, so the echoes are matched with the restored messages.
+        restoreOutbox();
+}
+
+void
+TimelineViewManager::restoreOutbox()
+{
+        using mtx::events::MessageType;
+
+        for (const auto &msg : cache::client()->outbox()) {
+                const auto room_id = QString::fromStdString(msg.room_id);
+
+                // We're no longer in the room.
+                if (!timelineViewExists(room_id)) {
+                        cache::client()->removeOutboxMessage(msg.txn_id);
+                        continue;
+                }
+
+                auto view           = views_.at(room_id);
+                const auto body     = QString::fromStdString(msg.body);
+                const auto filename = QString::fromStdString(msg.filename);
+                const auto mime     = QString::fromStdString(msg.mime);
+                const auto size     = msg.media_size;
+                const auto txn_id   = msg.txn_id;
+
+                switch (msg.type) {
+                case MessageType::Image:
+                        view->addUserMessage<ImageItem, MessageType::Image>(
+                          body, filename, mime, size, txn_id);
+                        break;
+                case MessageType::File:
+                        view->addUserMessage<FileItem, MessageType::File>(
+                          body, filename, mime, size, txn_id);
+                        break;
+                case MessageType::Audio:
+                        view->addUserMessage<AudioItem, MessageType::Audio>(
+                          body, filename, mime, size, txn_id);
+                        break;
+                case MessageType::Video:
+                        view->addUserMessage<VideoItem, MessageType::Video>(
+                          body, filename, mime, size, txn_id);
+                        break;
+                default:
+                        view->addUserMessage(msg.type, body, txn_id);
+                        break;
+                }
+        }
+}
+
+void
+TimelineViewManager::backfill(const std::vector<std::string> &rooms)
+{
+        for (const auto &room : rooms)
+                backfillQueue_.push_back(QString::fromStdString(room));
+
+        backfillNext();
+}
+
+void
+TimelineViewManager::backfillNext()
+{
+        while (backfillInFlight_.size() < BACKFILL_CONCURRENCY && !backfillQueue_.empty()) {
+                const auto room_id = backfillQueue_.front();
+                backfillQueue_.pop_front();
+
+                if (!timelineViewExists(room_id))
+                        continue;
+
+                if (views_.at(room_id)->prefetchHistory())
+                        backfillInFlight_.insert(room_id);
+        }
+}
+
+void
+TimelineViewManager::backfillDone(const QString &room_id)
+{
+        if (backfillInFlight_.erase(room_id) == 0)
+                return;
+
+        backfillNext();
 }
 
 void
@@ -237,6 +340,32 @@ TimelineViewManager::sync(const mtx::responses::Rooms &rooms)
         }
 }
 
+void
+TimelineViewManager::sync(
+  const std::map<QString, std::vector<const mtx::responses::JoinedRoom *>> &rooms)
+{
+        for (const auto &room : rooms) {
+                if (room.second.empty())
+                        continue;
+
+                auto timeline = room.second.cbegin();
+
+                // A new room starts with the first timeline it was seen with.
+                if (!timelineViewExists(room.first)) {
+                        snapshot::checkShared(**timeline, "TimelineViewManager");
+                        addRoom(**timeline, room.first);
+                        ++timeline;
+                }
+
+                auto view = views_.at(room.first);
+
+                for (; timeline != room.second.cend(); ++timeline) {
+                        snapshot::checkShared(**timeline, "TimelineViewManager");
+                        view->addEvents((*timeline)->timeline);
+                }
+        }
+}
+
 void
 TimelineViewManager::setHistoryView(const QString &room_id)
 {
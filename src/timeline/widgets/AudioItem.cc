@@ -18,7 +18,6 @@
 #include <QBrush>
 #include <QDebug>
 #include <QDesktopServices>
-#include <QFile>
 #include <QFileDialog>
 #include <QPainter>
 #include <QPixmap>
@@ -124,36 +123,40 @@ AudioItem::mousePressEvent(QMouseEvent *event)
 
                 update();
         } else {
+                // A second click cancels the download.
+                if (download_) {
+                        download_->cancel();
+                        progress_.clear();
+                        update();
+                        return;
+                }
+
                 filenameToSave_ = QFileDialog::getSaveFileName(this, tr("Save File"), text_);
 
                 if (filenameToSave_.isEmpty())
                         return;
 
-                auto proxy = http::client()->downloadFile(url_);
-                connect(proxy.data(),
-                        &DownloadMediaProxy::fileDownloaded,
-                        this,
-                        [proxy, this](const QByteArray &data) {
-                                proxy->deleteLater();
-                                fileDownloaded(data);
-                        });
+                startDownload();
         }
 }
 
 void
-AudioItem::fileDownloaded(const QByteArray &data)
+AudioItem::startDownload()
 {
-        try {
-                QFile file(filenameToSave_);
+        download_ = http::client()->downloadFile(url_, filenameToSave_);
 
-                if (!file.open(QIODevice::WriteOnly))
-                        return;
-
-                file.write(data);
-                file.close();
-        } catch (const std::exception &ex) {
-                qDebug() << "Error while saving file to:" << ex.what();
-        }
+        connect(download_, &FileDownload::progress, this, [this](qint64 received, qint64 total) {
+                progress_ = utils::transferProgress(received, total);
+                update();
+        });
+        connect(download_, &FileDownload::finished, this, [this]() {
+                progress_.clear();
+                update();
+        });
+        connect(download_, &FileDownload::failed, this, [this](const QString &msg) {
+                progress_ = tr("Download failed: %1").arg(msg);
+                update();
+        });
 }
 
 void
@@ -229,5 +232,6 @@ AudioItem::paintEvent(QPaintEvent *event)
         font.setWeight(50);
         painter.setFont(font);
         painter.setPen(QPen(textColor_));
-        painter.drawText(QPoint(textStartX, textStartY + 1.5 * fm.ascent()), readableFileSize_);
+        painter.drawText(QPoint(textStartX, textStartY + 1.5 * fm.ascent()),
+                         progress_.isEmpty() ? readableFileSize_ : progress_);
 }
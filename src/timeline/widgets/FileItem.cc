@@ -18,7 +18,6 @@
 #include <QBrush>
 #include <QDebug>
 #include <QDesktopServices>
-#include <QFile>
 #include <QFileDialog>
 #include <QPainter>
 #include <QPixmap>
@@ -110,38 +109,42 @@ FileItem::mousePressEvent(QMouseEvent *event)
         // Click on the download icon.
         if (QRect(HorizontalPadding, VerticalPadding / 2, IconDiameter, IconDiameter)
               .contains(point)) {
+                // A second click cancels the download.
+                if (download_) {
+                        download_->cancel();
+                        progress_.clear();
+                        update();
+                        return;
+                }
+
                 filenameToSave_ = QFileDialog::getSaveFileName(this, tr("Save File"), text_);
 
                 if (filenameToSave_.isEmpty())
                         return;
 
-                auto proxy = http::client()->downloadFile(url_);
-                connect(proxy.data(),
-                        &DownloadMediaProxy::fileDownloaded,
-                        this,
-                        [proxy, this](const QByteArray &data) {
-                                proxy->deleteLater();
-                                fileDownloaded(data);
-                        });
+                startDownload();
         } else {
                 openUrl();
         }
 }
 
 void
-FileItem::fileDownloaded(const QByteArray &data)
+FileItem::startDownload()
 {
-        try {
-                QFile file(filenameToSave_);
-
-                if (!file.open(QIODevice::WriteOnly))
-                        return;
-
-                file.write(data);
-                file.close();
-        } catch (const std::exception &ex) {
-                qDebug() << "Error while saving file to:" << ex.what();
-        }
+        download_ = http::client()->downloadFile(url_, filenameToSave_);
+
+        connect(download_, &FileDownload::progress, this, [this](qint64 received, qint64 total) {
+                progress_ = utils::transferProgress(received, total);
+                update();
+        });
+        connect(download_, &FileDownload::finished, this, [this]() {
+                progress_.clear();
+                update();
+        });
+        connect(download_, &FileDownload::failed, this, [this](const QString &msg) {
+                progress_ = tr("Download failed: %1").arg(msg);
+                update();
+        });
 }
 
 void
@@ -211,5 +214,6 @@ FileItem::paintEvent(QPaintEvent *event)
         font.setWeight(50);
         painter.setFont(font);
         painter.setPen(QPen(textColor_));
-        painter.drawText(QPoint(textStartX, textStartY + 1.5 * fm.ascent()), readableFileSize_);
+        painter.drawText(QPoint(textStartX, textStartY + 1.5 * fm.ascent()),
+                         progress_.isEmpty() ? readableFileSize_ : progress_);
 }
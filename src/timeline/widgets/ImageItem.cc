@@ -15,9 +15,11 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <QApplication>
 #include <QBrush>
 #include <QDebug>
 #include <QDesktopServices>
+#include <QDesktopWidget>
 #include <QFileDialog>
 #include <QFileInfo>
 #include <QPainter>
@@ -25,6 +27,7 @@
 #include <QUuid>
 
 #include "Config.h"
+#include "ImageCache.h"
 #include "MatrixClient.h"
 #include "Utils.h"
 #include "dialogs/ImageOverlay.h"
@@ -41,26 +44,14 @@ ImageItem::ImageItem(const mtx::events::RoomEvent<mtx::events::msg::Image> &even
         url_  = QString::fromStdString(event.content.url);
         text_ = QString::fromStdString(event.content.body);
 
-        QList<QString> url_parts = url_.toString().split("mxc://");
-
-        if (url_parts.size() != 2) {
-                qDebug() << "Invalid format for image" << url_.toString();
-                return;
+        // Reserve the space of the image, so the timeline doesn't jump when it arrives.
+        const auto &info = event.content.info;
+        if (info.w > 0 && info.h > 0) {
+                reserved_size_ = utils::scaledSize(max_width_, max_height_, QSize(info.w, info.h));
+                setFixedSize(reserved_size_);
         }
 
-        QString media_params = url_parts[1];
-        url_                 = QString("%1/_matrix/media/r0/download/%2")
-                 .arg(http::client()->getHomeServer().toString(), media_params);
-
-        auto proxy = http::client()->downloadImage(url_);
-
-        connect(proxy.data(),
-                &DownloadMediaProxy::imageDownloaded,
-                this,
-                [this, proxy](const QPixmap &img) {
-                        proxy->deleteLater();
-                        setImage(img);
-                });
+        loadThumbnail();
 }
 
 ImageItem::ImageItem(const QString &url, const QString &filename, uint64_t size, QWidget *parent)
@@ -74,6 +65,12 @@ ImageItem::ImageItem(const QString &url, const QString &filename, uint64_t size,
         setCursor(Qt::PointingHandCursor);
         setAttribute(Qt::WA_Hover, true);
 
+        loadThumbnail();
+}
+
+void
+ImageItem::loadThumbnail()
+{
         QList<QString> url_parts = url_.toString().split("mxc://");
 
         if (url_parts.size() != 2) {
@@ -81,18 +78,41 @@ ImageItem::ImageItem(const QString &url, const QString &filename, uint64_t size,
                 return;
         }
 
+        // Request the preview at the resolution it will be displayed at.
+        thumbnail_size_ =
+          (reserved_size_.isValid() ? reserved_size_ : QSize(max_width_, max_height_)) *
+          devicePixelRatioF();
+        thumbnail_url_ = http::client()->thumbnailUrl(url_, thumbnail_size_);
+        cache_key_     = imagecache::key(thumbnail_url_.toString(), thumbnail_size_);
+
         QString media_params = url_parts[1];
         url_                 = QString("%1/_matrix/media/r0/download/%2")
                  .arg(http::client()->getHomeServer().toString(), media_params);
 
-        auto proxy = http::client()->downloadImage(url_);
+        // Promoted once the item is actually painted.
+        fetchThumbnail(MediaScheduler::Priority::Background);
+}
+
+void
+ImageItem::fetchThumbnail(MediaScheduler::Priority priority)
+{
+        const auto cached = imagecache::find(cache_key_);
+
+        if (!cached.isNull()) {
+                setImage(QPixmap::fromImage(cached));
+                return;
+        }
+
+        auto proxy = http::client()->downloadImage(thumbnail_url_, thumbnail_size_, priority);
 
         connect(proxy.data(),
                 &DownloadMediaProxy::imageDownloaded,
                 this,
-                [proxy, this](const QPixmap &img) {
+                [this, proxy](const QImage &img) {
                         proxy->deleteLater();
-                        setImage(img);
+
+                        imagecache::insert(cache_key_, img);
+                        setImage(QPixmap::fromImage(img));
                 });
 }
 
@@ -109,8 +129,12 @@ ImageItem::openUrl()
 QSize
 ImageItem::sizeHint() const
 {
-        if (image_.isNull())
+        if (image_.isNull()) {
+                if (reserved_size_.isValid())
+                        return reserved_size_;
+
                 return QSize(max_width_, bottom_height_);
+        }
 
         return QSize(width_, height_);
 }
@@ -118,14 +142,34 @@ ImageItem::sizeHint() const
 void
 ImageItem::setImage(const QPixmap &image)
 {
-        image_        = image;
-        scaled_image_ = utils::scaleDown<QPixmap>(max_width_, max_height_, image_);
+        image_ = image;
+
+        scaleImage();
+        update();
+}
+
+void
+ImageItem::scaleImage()
+{
+        const auto size = reserved_size_.isValid()
+                            ? reserved_size_
+                            : utils::scaledSize(max_width_, max_height_, image_.size());
+        const auto ratio = devicePixelRatioF();
 
-        width_  = scaled_image_.width();
-        height_ = scaled_image_.height();
+        // The preview is kept at the resolution of the screen. It's usually decoded
+        // at exactly that size already, in which case there is nothing left to do.
+        if (image_.size() == size * ratio)
+                scaled_image_ = image_;
+        else
+                scaled_image_ =
+                  image_.scaled(size * ratio, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+
+        scaled_image_.setDevicePixelRatio(ratio);
+
+        width_  = size.width();
+        height_ = size.height();
 
         setFixedSize(width_, height_);
-        update();
 }
 
 void
@@ -147,23 +191,50 @@ ImageItem::mousePressEvent(QMouseEvent *event)
         if (textRegion_.contains(event->pos())) {
                 openUrl();
         } else {
+                // Show the preview until the original arrives.
                 auto imgDialog = new dialogs::ImageOverlay(image_);
                 imgDialog->show();
+
+                // There is no point in decoding more than what fits on the screen.
+                const auto screen =
+                  QApplication::desktop()->availableGeometry(this).size() * devicePixelRatioF();
+
+                auto proxy = http::client()->downloadImage(
+                  url_, screen, MediaScheduler::Priority::Visible);
+
+                connect(proxy.data(),
+                        &DownloadMediaProxy::imageDownloaded,
+                        imgDialog,
+                        [imgDialog, proxy](const QImage &img) {
+                                proxy->deleteLater();
+                                imgDialog->setImage(QPixmap::fromImage(img));
+                        });
         }
 }
 
+void
+ImageItem::hideEvent(QHideEvent *event)
+{
+        QWidget::hideEvent(event);
+
+        if (image_.isNull())
+                return;
+
+        // The images are only kept while they're shown. The item keeps its size
+        // in the meantime, so the layout doesn't change while it's being reloaded.
+        reserved_size_ = QSize(width_, height_);
+        image_         = QPixmap();
+        scaled_image_  = QPixmap();
+        released_      = true;
+}
+
 void
 ImageItem::resizeEvent(QResizeEvent *event)
 {
         if (!image_)
                 return QWidget::resizeEvent(event);
 
-        scaled_image_ = utils::scaleDown<QPixmap>(max_width_, max_height_, image_);
-
-        width_  = scaled_image_.width();
-        height_ = scaled_image_.height();
-
-        setFixedSize(width_, height_);
+        scaleImage();
 }
 
 void
@@ -180,7 +251,25 @@ ImageItem::paintEvent(QPaintEvent *event)
         QFontMetrics metrics(font);
         const int fontHeight = metrics.height() + metrics.ascent();
 
+        if (image_.isNull() && released_) {
+                released_ = false;
+                fetchThumbnail(MediaScheduler::Priority::Visible);
+        }
+
         if (image_.isNull()) {
+                if (!prioritized_) {
+                        prioritized_ = true;
+                        http::client()->media()->prioritize(thumbnail_url_);
+                }
+
+                if (reserved_size_.isValid()) {
+                        QPainterPath placeholder;
+                        placeholder.addRoundedRect(QRectF(QPointF(0, 0), reserved_size_), 5, 5);
+
+                        painter.fillPath(placeholder, QColor(128, 128, 128, 40));
+                        return;
+                }
+
                 QString elidedText = metrics.elidedText(text_, Qt::ElideRight, max_width_ - 10);
 
                 setFixedSize(metrics.width(elidedText), fontHeight);
@@ -197,9 +286,9 @@ ImageItem::paintEvent(QPaintEvent *event)
         QPainterPath path;
         path.addRoundedRect(imageRegion_, 5, 5);
 
-        painter.setPen(Qt::NoPen);
-        painter.fillPath(path, scaled_image_);
-        painter.drawPath(path);
+        painter.setClipPath(path);
+        painter.drawPixmap(QPoint(0, 0), scaled_image_);
+        painter.setClipping(false);
 
         // Bottom text section
         if (isInteractive_ && underMouse()) {
@@ -231,23 +320,6 @@ ImageItem::saveAs()
         if (filename.isEmpty())
                 return;
 
-        auto proxy = http::client()->downloadFile(url_);
-        connect(proxy.data(),
-                &DownloadMediaProxy::fileDownloaded,
-                this,
-                [proxy, filename](const QByteArray &data) {
-                        proxy->deleteLater();
-
-                        try {
-                                QFile file(filename);
-
-                                if (!file.open(QIODevice::WriteOnly))
-                                        return;
-
-                                file.write(data);
-                                file.close();
-                        } catch (const std::exception &ex) {
-                                qDebug() << "Error while saving file to:" << ex.what();
-                        }
-                });
+        // Failures are logged by the download.
+        http::client()->downloadFile(url_, filename);
 }
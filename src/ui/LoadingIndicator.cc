@@ -83,3 +83,12 @@ LoadingIndicator::onTimeout()
         angle_ = (angle_ + 45) % 360;
         update();
 }
+
+void
+LoadingIndicator::mousePressEvent(QMouseEvent *e)
+{
+        if (e->button() == Qt::LeftButton)
+                emit clicked();
+
+        QWidget::mousePressEvent(e);
+}